@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,34 +22,205 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "shrinker.h"
 
-struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+// Buffers are found through a hash table of buckets, each with
+// its own lock, so lookups of different blocks run in parallel.
+// Buffers come from a slab cache. On a miss, bget takes a
+// buffer from the free list, or makes a new one while the buddy
+// allocator has more than BCACHE_SPARE free pages; only then
+// does it recycle the least recently used unreferenced buffer.
+// Under memory pressure the shrinker frees unreferenced buffers
+// down to NBUF, which binit allocates up front.
+#define NBUCKET 61
+#define BCACHE_SPARE 256
+
+struct bucket {
+  struct spinlock lock;   // protects the chain and its bufs' refcnt
+  struct buf *head;       // via b->next and b->prev
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;   // protects free and nbuf; serializes eviction
+  struct kmem_cache *cache;
+  struct buf *free;       // buffers holding no block, via b->next
+  int nbuf;
+  uint64 clock;           // stamps b->lastuse; bumped atomically
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bbucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev ^ blockno) % NBUCKET];
+}
+
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+static void
+bk_add(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(bk->head)
+    bk->head->prev = b;
+  bk->head = b;
+}
+
+static void
+bk_remove(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+  b->next = b->prev = 0;
+}
+
+// Sleep-locks are released before a buffer is freed, so
+// they are set up once per slab object.
+static void
+bufctor(void *p)
+{
+  initsleeplock(&((struct buf*)p)->lock, "buffer");
+}
+
+// Take the least recently used unreferenced buffer out of
+// its bucket, or return 0 if every buffer is in use.
+// Caller must hold bcache.lock.
+static struct buf*
+bevict(void)
+{
+  struct buf *b, *best;
+  struct bucket *bk, *bestbk;
+
+  for(;;){
+    best = 0;
+    bestbk = 0;
+    for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++){
+      acquire(&bk->lock);
+      for(b = bk->head; b; b = b->next){
+        if(b->refcnt == 0 && (best == 0 || b->lastuse < best->lastuse)){
+          best = b;
+          bestbk = bk;
+        }
+      }
+      release(&bk->lock);
+    }
+    if(best == 0)
+      return 0;
+
+    // bcache.lock keeps other evictors away, so best is still
+    // in bestbk; but bget may have found it meanwhile.
+    acquire(&bestbk->lock);
+    if(best->refcnt == 0){
+      bk_remove(bestbk, best);
+      release(&bestbk->lock);
+      return best;
+    }
+    release(&bestbk->lock);
+  }
+}
+
+// A buffer to hold a block that is not cached.
+static struct buf*
+bnew(void)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  if((b = bcache.free) != 0){
+    bcache.free = b->next;
+    release(&bcache.lock);
+    return b;
+  }
+  release(&bcache.lock);
+
+  // Allocate without bcache.lock: allocating may reclaim
+  // memory, and the shrinker below takes bcache.lock.
+  if(buddy_free_pages() > BCACHE_SPARE && (b = kmem_cache_alloc(bcache.cache)) != 0){
+    acquire(&bcache.lock);
+    bcache.nbuf++;
+    release(&bcache.lock);
+    return b;
+  }
+
+  acquire(&bcache.lock);
+  b = bevict();
+  release(&bcache.lock);
+  if(b == 0)
+    panic("bget: no buffers");
+  return b;
+}
+
+// The buffer cache shrinker: frees unreferenced buffers,
+// least recently used first, but keeps NBUF of them. They go
+// straight into their slabs rather than this hart's magazines,
+// and the slabs that emptied go back to the buddy allocator.
+static uint64
+bcount(void)
+{
+  int extra = bcache.nbuf - NBUF;
+  return extra > 0 ? (uint64)extra * sizeof(struct buf) / PGSIZE : 0;
+}
+
+static uint64
+bscan(uint64 n)
+{
+  struct buf *b;
+  uint64 bytes = 0;
+
+  acquire(&bcache.lock);
+  while(bytes / PGSIZE < n && bcache.nbuf > NBUF){
+    if((b = bcache.free) != 0)
+      bcache.free = b->next;
+    else if((b = bevict()) == 0)
+      break;
+    kmem_cache_free_bulk(bcache.cache, 1, (void**)&b);
+    bcache.nbuf--;
+    bytes += sizeof(struct buf);
+  }
+  release(&bcache.lock);
+  return kmem_cache_shrink(bcache.cache);
+}
+
+static struct shrinker bshrinker = {
+  .count = bcount,
+  .scan = bscan,
+};
+
 void
 binit(void)
 {
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf), 0, bufctor, 0);
+  if(bcache.cache == 0)
+    panic("binit");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Enough buffers for the log to always make progress.
+  for(int i = 0; i < NBUF; i++){
+    if((b = kmem_cache_alloc(bcache.cache)) == 0)
+      panic("binit");
+    b->next = bcache.free;
+    bcache.free = b;
+    bcache.nbuf++;
   }
+  register_shrinker(&bshrinker);
 }
 
 // Look through buffer cache for block on device dev.
@@ -58,34 +229,43 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct bucket *bk = bbucket(dev, blockno);
+  struct buf *b, *nb;
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached. Get a buffer without holding the bucket
+  // lock, then check that no one cached the block meanwhile.
+  nb = bnew();
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquire(&bcache.lock);
+    nb->next = bcache.free;
+    bcache.free = nb;
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+  b = nb;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  bk_add(bk, b);
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -112,42 +292,43 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Stamp it for least-recently-used eviction.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk = bbucket(b->dev, b->blockno);
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = __atomic_add_fetch(&bcache.clock, 1, __ATOMIC_RELAXED);
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bbucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bbucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 
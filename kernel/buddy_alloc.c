@@ -10,6 +10,7 @@
 #include "defs.h"
 #include "lib/buddy_alloc/buddy_alloc.h"
 #include "buddy_alloc.h"
+#include "shrinker.h"
 
 
 extern char end[]; // first address after kernel.
@@ -20,11 +21,48 @@ struct {
   buddy_allocator_t mem;
 } buddy_mem;
 
+// Registered shrinkers. The lock also serializes reclaim, so
+// harts that run out of memory together do not all scan.
+struct {
+  struct spinlock lock;
+  struct shrinker *head;
+  uint64 reclaimed;   // pages freed by shrinkers since boot
+} shrinkers;
+
+// The second reclaim pass asks for this many times the pages
+// wanted, so that freed pages have a chance to coalesce.
+#define RECLAIM_RETRY 16
+
+// Per-hart counters. A hart only updates its own entry,
+// with buddy_mem.lock held, and the entries are cache-line
+// aligned, so counting adds no sharing between harts.
+// sys_buddy_info sums them on demand.
+struct buddy_stat {
+  uint64 allocs[BUDDY_LEVELS];
+  uint64 frees[BUDDY_LEVELS];
+  uint64 failures;
+  uint64 splits;
+  uint64 merges;
+  uint64 spins;
+} __attribute__((aligned(CACHELINE)));
+
+static struct buddy_stat buddy_stats[NCPU];
+
+static int
+buddy_order(uint64 pages)
+{
+  int order = 0;
+  while(order < BUDDY_LEVELS && (1L << order) != pages)
+    order++;
+  return order;
+}
+
 
 void 
 buddy_init()
 {
     initlock(&buddy_mem.lock, "buddy_mem"); 
+    initlock(&shrinkers.lock, "shrinkers");
 
     void* first_page = (void*)PGROUNDUP((uint64)end);
     uint64 space_size = (char*)PHYSTOP - (char*)first_page;
@@ -41,33 +79,195 @@ buddy_init()
         panic("buddy init");
 }
 
+// Allocates without trying to reclaim memory first. The slab
+// layer grows its caches with this, because it calls in with a
+// cache lock held and reclaim needs the cache locks.
 void* 
-buddy_alloc(uint64 pages)
+buddy_alloc_noreclaim(uint64 pages)
 {
-    acquire(&buddy_mem.lock);
+    uint64 spins = acquire_spin(&buddy_mem.lock);
+    struct buddy_stat* st = &buddy_stats[cpuid()];
+    uint64 splits = buddy_mem.mem.splits;
+
     void* ptr = lib_buddy_alloc(&buddy_mem.mem, pages);
+
+    st->spins += spins;
+    st->splits += buddy_mem.mem.splits - splits;
+    if(ptr)
+        st->allocs[buddy_order(pages)] += 1;
+    else
+        st->failures += 1;
     release(&buddy_mem.lock);
     return ptr;
 }
 
+// Allocates up to n single pages under one acquisition of the
+// lock, for callers that keep their own cache of pages. Does
+// not reclaim. Returns how many pages were stored in out.
+int
+buddy_alloc_bulk(int n, void** out)
+{
+    uint64 spins = acquire_spin(&buddy_mem.lock);
+    struct buddy_stat* st = &buddy_stats[cpuid()];
+    uint64 splits = buddy_mem.mem.splits;
+    int got = 0;
+
+    while(got < n && (out[got] = lib_buddy_alloc(&buddy_mem.mem, 1)) != 0)
+        got++;
+
+    st->spins += spins;
+    st->splits += buddy_mem.mem.splits - splits;
+    st->allocs[0] += got;
+    if(got < n)
+        st->failures += 1;
+    release(&buddy_mem.lock);
+    return got;
+}
+
+// Under memory pressure, first asks the shrinkers for about as
+// many pages as are wanted. The freed pages may not coalesce
+// into a big enough block, so if that is not enough, asks them
+// once more for RECLAIM_RETRY times as many.
+void* 
+buddy_alloc(uint64 pages)
+{
+    void* ptr = buddy_alloc_noreclaim(pages);
+    if(ptr == 0 && buddy_reclaim(pages) != 0)
+        ptr = buddy_alloc_noreclaim(pages);
+    if(ptr == 0 && buddy_reclaim(pages * RECLAIM_RETRY) != 0)
+        ptr = buddy_alloc_noreclaim(pages);
+    return ptr;
+}
+
+void
+register_shrinker(struct shrinker *s)
+{
+    acquire(&shrinkers.lock);
+    s->next = shrinkers.head;
+    shrinkers.head = s;
+    release(&shrinkers.lock);
+}
+
+// Calls the shrinkers until they have given back at least
+// pages pages, or all they could. Returns the number of
+// pages freed. Must be called without allocator locks held.
+uint64
+buddy_reclaim(uint64 pages)
+{
+    uint64 freed = 0;
+    acquire(&shrinkers.lock);
+    for(struct shrinker *s = shrinkers.head; s && freed < pages; s = s->next){
+        if(s->count() == 0)
+            continue;
+        freed += s->scan(pages - freed);
+    }
+    shrinkers.reclaimed += freed;
+    release(&shrinkers.lock);
+    return freed;
+}
+
 void 
 buddy_free(void* addr)
+{
+    uint64 spins = acquire_spin(&buddy_mem.lock);
+    struct buddy_stat* st = &buddy_stats[cpuid()];
+    uint64 merges = buddy_mem.mem.merges;
+
+    int lvl = lib_buddy_free(&buddy_mem.mem, addr);
+
+    st->spins += spins;
+    st->merges += buddy_mem.mem.merges - merges;
+    st->frees[lvl] += 1;
+    release(&buddy_mem.lock);
+}
+
+// Takes another reference to the block that starts at addr.
+void
+buddy_get(void* addr)
 {
     acquire(&buddy_mem.lock);
-    lib_buddy_free(&buddy_mem.mem, addr);
+    lib_buddy_get(&buddy_mem.mem, addr);
     release(&buddy_mem.lock);
 }
 
+// Drops a reference to the block that starts at addr and
+// frees the block when it was the last one.
+void
+buddy_put(void* addr)
+{
+    uint64 spins = acquire_spin(&buddy_mem.lock);
+    struct buddy_stat* st = &buddy_stats[cpuid()];
+    uint64 merges = buddy_mem.mem.merges;
+
+    int lvl = lib_buddy_put(&buddy_mem.mem, addr);
+
+    st->spins += spins;
+    st->merges += buddy_mem.mem.merges - merges;
+    if(lvl != BUDDY_NOTHING)
+        st->frees[lvl] += 1;
+    release(&buddy_mem.lock);
+}
+
+// Returns the descriptor of the page containing addr, or 0
+// if addr is not in the heap. No lock: the owner of a block
+// may set flags and rmap of its first page on its own.
+struct buddy_frame*
+buddy_frame(void* addr)
+{
+    return lib_buddy_frame(&buddy_mem.mem, addr);
+}
+
+
+// Number of free pages. No lock: the list lengths are read
+// racily, which is good enough for sizing caches.
+uint64
+buddy_free_pages(void)
+{
+    uint64 free;
+    lib_buddy_stat(&buddy_mem.mem, 0, &free, 0);
+    return free;
+}
+
+// Returns the start of the allocated block containing addr.
+// No lock: the lookup only reads state_table entries inside
+// that block, and they stay put while the block is allocated.
+void*
+buddy_block_start(void* addr)
+{
+    void* start = lib_buddy_block_start(&buddy_mem.mem, addr);
+    if(start == 0)
+        panic("buddy_block_start");
+    return start;
+}
+
 
 uint64 sys_buddy_info(void){
     uint64 user_info_struct;
     argaddr(0, &user_info_struct);
 
     struct buddy_info info;
+    memset(&info, 0, sizeof(info));
 
     acquire(&buddy_mem.lock);
     lib_buddy_stat(&buddy_mem.mem, &info.total, &info.free, info.free_by_size);
     release(&buddy_mem.lock);
 
+    // Counters are read without the lock: each one only grows,
+    // so a slightly stale sum is fine for statistics.
+    for(int i = 0; i < NCPU; i++){
+        struct buddy_stat* st = &buddy_stats[i];
+        for(int lvl = 0; lvl < BUDDY_LEVELS; lvl++){
+            info.allocs[lvl] += st->allocs[lvl];
+            info.frees[lvl] += st->frees[lvl];
+        }
+        info.failures += st->failures;
+        info.splits += st->splits;
+        info.merges += st->merges;
+        info.spins += st->spins;
+    }
+    info.reclaimed = shrinkers.reclaimed;
+    slab_stat(&info);
+    ptcache_stat(&info);
+
     return either_copyout(1, user_info_struct, &info, sizeof(info));
 }
\ No newline at end of file
@@ -1,8 +1,53 @@
-
 #define BUDDY_LEVELS 10
 
 struct buddy_info{
   uint64 total;
   uint64 free;
   uint64 free_by_size[BUDDY_LEVELS];
-};
\ No newline at end of file
+
+  // counters since boot, summed over all harts
+  uint64 allocs[BUDDY_LEVELS];  // successful allocations by order
+  uint64 frees[BUDDY_LEVELS];   // frees by order
+  uint64 failures;              // allocation attempts that found no free block
+  uint64 splits;                // blocks split in half to satisfy an allocation
+  uint64 merges;                // buddies coalesced on free
+  uint64 spins;                 // busy-waits on the buddy lock
+  uint64 reclaimed;             // pages given back by shrinkers under pressure
+
+  // the same for all slab caches together
+  uint64 slab_allocs;
+  uint64 slab_frees;
+  uint64 slab_failures;
+  uint64 slab_spins;
+
+  // page-table pages
+  uint64 pt_allocs;   // pages handed to walk() and uvmcreate()
+  uint64 pt_cached;   // of them, taken pre-zeroed from a per-hart cache
+  uint64 pt_refills;  // bulk refills of a per-hart cache
+  uint64 pt_time;     // timer cycles spent getting the pages
+};
+
+// What a frame is used for, in the flags of its descriptor.
+// Blocks start out as FRAME_KERNEL.
+#define FRAME_KERNEL    0
+#define FRAME_USER      1   // user memory; rmap is its PTE, 0 if shared
+#define FRAME_PAGETABLE 2
+
+#define SLAB_NAME 16
+
+// One slab cache, as reported by slab_info
+struct slab_info{
+  char name[SLAB_NAME];
+  uint64 size;        // object size asked for at kmem_cache_create
+  uint64 cell;        // bytes per object with alignment and free link
+  uint64 per_slab;    // objects per slab
+  uint64 slab_pages;  // pages per slab
+  uint64 active;      // objects in use
+  uint64 cached;      // free objects held in per-hart and depot magazines
+  uint64 slabs;       // slabs in total
+  uint64 partial;     // slabs with both used and free objects
+  uint64 empty;       // slabs kept in the empty reserve
+  uint64 waste;       // bytes of slab memory not taken by active objects
+  uint64 allocs;      // counters since boot, summed over all harts
+  uint64 frees;
+};
@@ -5,8 +5,9 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint64 lastuse;   // bcache.clock at the last brelse, for LRU eviction
+  struct buf *prev; // hash bucket chain
+  struct buf *next; // hash bucket chain, or bcache free list
   uchar data[BSIZE];
 };
 
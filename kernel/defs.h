@@ -10,17 +10,11 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct buddy_info;
+struct buddy_frame;
+struct shrinker;
+struct kmem_cache;
 struct superblock;
 
-enum SlabStructs{
-    // virtio.h
-    SLAB_virtq_desc,        
-    SLAB_virtq_avail,
-    SLAB_virtq_used,
-    // pipe.c
-    SLAB_pipe,
-};
-
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
@@ -75,16 +69,33 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kmalloc(uint64);
 
 // buddy_alloc.c
 void            buddy_init();
 void*           buddy_alloc(uint64 pages);
+void*           buddy_alloc_noreclaim(uint64 pages);
+int             buddy_alloc_bulk(int n, void** out);
 void            buddy_free(void* addr);
+void            buddy_get(void* addr);
+void            buddy_put(void* addr);
+struct buddy_frame* buddy_frame(void* addr);
+uint64          buddy_reclaim(uint64 pages);
+void            register_shrinker(struct shrinker*);
+void*           buddy_block_start(void* addr);
+uint64          buddy_free_pages(void);
 
 // slab_alloc.c
 void            slab_init();
-void*           slab_alloc(int slab_struct);
-void            slab_free(int slab_struct, void* ptr);
+struct kmem_cache* kmem_cache_create(char* name, uint size, uint align, void (*ctor)(void*), void (*dtor)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void* ptr);
+uint            kmem_cache_alloc_bulk(struct kmem_cache*, uint n, void** out);
+void            kmem_cache_free_bulk(struct kmem_cache*, uint n, void** ptrs);
+uint64          kmem_cache_shrink(struct kmem_cache*);
+void            slab_stat(struct buddy_info*);
+void*           slab_kmalloc(uint64 size);
+void            slab_free_any(void* ptr);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -93,6 +104,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -108,7 +120,6 @@ int             cpuid(void);
 void            exit(int);
 int             fork(void);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -134,6 +145,7 @@ void            swtch(struct context*, struct context*);
 
 // spinlock.c
 void            acquire(struct spinlock*);
+uint64          acquire_spin(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
@@ -180,6 +192,7 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            ptcache_stat(struct buddy_info*);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // itable hash chain
+  struct inode *lrunext; // itable LRU list, while ref is 0
+  struct inode *lruprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
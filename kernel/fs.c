@@ -18,6 +18,7 @@
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
+#include "shrinker.h"
 #include "buf.h"
 #include "file.h"
 
@@ -129,18 +130,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and
+//   current directories). iget() finds or creates a
+//   table entry and increments its ref; iput() decrements
+//   ref. An entry whose ref is zero stays cached on an
+//   LRU list until iget() recycles it or the inode
+//   shrinker frees it.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -165,28 +167,137 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries, the hash chains and the LRU list. Since ip->ref
+// indicates whether an entry is in use, and ip->dev and
+// ip->inum indicate which i-node an entry holds, one must
+// hold itable.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+// Entries come from a slab cache and are found through a
+// hash table keyed by (dev, inum). The table grows while
+// there is memory; iget() recycles the least recently used
+// unreferenced entry only when an allocation fails, and the
+// shrinker frees unreferenced entries under memory pressure.
+#define NIHASH 64
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH];   // chains via ip->hnext
+  struct inode *lruhead;        // unreferenced entries, oldest first,
+  struct inode *lrutail;        // via ip->lrunext and ip->lruprev
+  uint nlru;
 } itable;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &itable.hash[(dev * 31 + inum) % NIHASH];
+}
+
+static struct inode*
+icached(uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext)
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  return 0;
+}
+
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = ihash(ip->dev, ip->inum); *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
+  ip->hnext = 0;
+}
+
+static void
+lru_add(struct inode *ip)
+{
+  ip->lrunext = 0;
+  ip->lruprev = itable.lrutail;
+  if(itable.lrutail)
+    itable.lrutail->lrunext = ip;
+  else
+    itable.lruhead = ip;
+  itable.lrutail = ip;
+  itable.nlru++;
+}
+
+static void
+lru_remove(struct inode *ip)
+{
+  if(ip->lruprev)
+    ip->lruprev->lrunext = ip->lrunext;
+  else
+    itable.lruhead = ip->lrunext;
+  if(ip->lrunext)
+    ip->lrunext->lruprev = ip->lruprev;
+  else
+    itable.lrutail = ip->lruprev;
+  ip->lrunext = ip->lruprev = 0;
+  itable.nlru--;
+}
+
+// Entries are freed unlocked, so the sleep-lock is
+// set up once per slab object.
+static void
+inodector(void *p)
+{
+  initsleeplock(&((struct inode*)p)->lock, "inode");
+}
+
+// The inode shrinker: frees unreferenced entries, oldest first,
+// straight into their slabs rather than this hart's magazines,
+// then gives the slabs that emptied back to the buddy allocator.
+static uint64
+icount(void)
+{
+  return (uint64)itable.nlru * sizeof(struct inode) / PGSIZE;
+}
+
+static uint64
+iscan(uint64 n)
+{
+  struct inode *ip;
+  uint64 bytes = 0;
+
+  acquire(&itable.lock);
+  while(bytes / PGSIZE < n && (ip = itable.lruhead) != 0){
+    lru_remove(ip);
+    iunhash(ip);
+    kmem_cache_free_bulk(itable.cache, 1, (void**)&ip);
+    bytes += sizeof(struct inode);
+  }
+  release(&itable.lock);
+  return kmem_cache_shrink(itable.cache);
+}
+
+static struct shrinker ishrinker = {
+  .count = icount,
+  .scan = iscan,
+};
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode), 0, inodector, 0);
+  if(itable.cache == 0)
+    panic("iinit");
+  register_shrinker(&ishrinker);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +357,44 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *new = 0;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  if((ip = icached(dev, inum)) == 0){
+    // Allocate without itable.lock: allocating may reclaim
+    // memory, and the inode shrinker takes itable.lock.
+    release(&itable.lock);
+    new = kmem_cache_alloc(itable.cache);
+    acquire(&itable.lock);
+    ip = icached(dev, inum);  // someone may have added it meanwhile
+  }
+  if(ip){
+    if(ip->ref == 0)
+      lru_remove(ip);
+    ip->ref++;
+    release(&itable.lock);
+    if(new)
+      kmem_cache_free(itable.cache, new);
+    return ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Out of memory: recycle the least recently used entry.
+  if(new == 0){
+    if((new = itable.lruhead) == 0)
+      panic("iget: no inodes");
+    lru_remove(new);
+    iunhash(new);
+  }
 
-  ip = empty;
+  ip = new;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *ihash(dev, inum);
+  *ihash(dev, inum) = ip;
   release(&itable.lock);
 
   return ip;
@@ -327,8 +451,9 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry
+// goes on the LRU list, or is freed if it holds nothing
+// worth caching.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -358,6 +483,14 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    if(ip->valid){
+      lru_add(ip);
+    } else {
+      iunhash(ip);
+      kmem_cache_free(itable.cache, ip);
+    }
+  }
   release(&itable.lock);
 }
 
@@ -1,5 +1,6 @@
 
 #include "types.h"
+#include "param.h"
 #include "riscv.h"
 #include "defs.h"
 
@@ -11,10 +12,17 @@ kinit()
 
 
 
+// Free memory returned by kalloc() or kmalloc().
+// Blocks from the buddy allocator start at their block and
+// are only freed when the last reference is dropped;
+// anything inside a block is a slab object.
 void
 kfree(void *pa)
 {
-  buddy_free(pa);
+  if(buddy_block_start(pa) == pa)
+    buddy_put(pa);
+  else
+    slab_free_any(pa);
 }
 
 
@@ -24,6 +32,22 @@ kalloc(void)
   return buddy_alloc(1);
 }
 
+// Allocate size bytes. Small sizes come from power-of-two
+// slab caches, aligned to the class size but to no more than
+// CACHELINE bytes; larger ones are rounded up to a power of
+// two pages. Returns 0 if the memory cannot be allocated.
+void *
+kmalloc(uint64 size)
+{
+  uint64 pages = 1;
+
+  if(size <= KMALLOC_MAX)
+    return slab_kmalloc(size);
+  while(pages * PGSIZE < size)
+    pages *= 2;
+  return buddy_alloc(pages);
+}
+
 
 /*
 
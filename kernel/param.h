@@ -1,13 +1,15 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes (kernel stack slots)
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // old i-node table size; usertests' iref goes past it
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define KMALLOC_MIN    16  // smallest kmalloc size class
+#define KMALLOC_CLASSES 8  // kmalloc size classes: 16, 32, ..., 2048 bytes
+#define KMALLOC_MAX    (KMALLOC_MIN << (KMALLOC_CLASSES-1)) // larger sizes come from buddy
@@ -10,6 +10,27 @@
 #include "pipe.h"
 
 
+static struct kmem_cache *pipe_cache;
+
+// Slab constructor: runs once per object, not on every
+// pipealloc. pipeclose frees a pipe with its lock released,
+// which is the state the constructor leaves it in.
+static void
+pipector(void *ptr)
+{
+  struct pipe *pi = ptr;
+  initlock(&pi->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  // line-aligned so that pipe locks don't share cache lines
+  pipe_cache = kmem_cache_create("pipe", sizeof(struct pipe), CACHELINE, pipector, 0);
+  if(pipe_cache == 0)
+    panic("pipeinit");
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -19,14 +40,12 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  //if((pi = (struct pipe*)kalloc()) == 0)
-  if((pi = (struct pipe*)slab_alloc(SLAB_pipe)) == 0)
+  if((pi = (struct pipe*)kmem_cache_alloc(pipe_cache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -39,8 +58,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    // kfree((char*)pi);
-    slab_free(SLAB_pipe, pi);
+    kmem_cache_free(pipe_cache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -61,8 +79,7 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    //kfree((char*)pi);
-    slab_free(SLAB_pipe, pi);
+    kmem_cache_free(pipe_cache, pi);
   } else
     release(&pi->lock);
 }
@@ -5,57 +5,163 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "shrinker.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// Process structures come from a slab cache as they are needed.
+// An exited process goes on a free list, with its kernel stack
+// still mapped, and is reused by the next fork. Under memory
+// pressure the proc shrinker unmaps and frees the stacks of free
+// procs and the procs themselves; their stack slots are reused.
+// A hart flushes its TLB before it runs a process whose stack
+// was mapped since its last flush (see scheduler()).
+struct {
+  struct spinlock lock;   // protects everything here
+  struct proc *all;       // every struct proc, via allnext
+  struct proc *free;      // UNUSED ones, via nextfree
+  int nfree;              // length of free
+  int nslot;              // kernel stack slots ever used
+  int nfreeslot;          // slots given back, in freeslot
+  ushort freeslot[NPROC];
+  uint64 kstackgen;       // bumped whenever a stack is mapped
+} ptable;
+
+static struct kmem_cache *proc_cache;
 
 struct proc *initproc;
 
+// pid_lock protects nextpid, the pid hash and p->killers. kill
+// finds its victim there instead of scanning every process.
+#define NPIDHASH 64
 int nextpid = 1;
 struct spinlock pid_lock;
+static struct proc *pidhash[NPIDHASH];
+
+// Sleeping processes wait on a queue picked by hashing the
+// channel, so wakeup only looks at processes that may be
+// sleeping on it. A process is on a queue exactly while it is
+// SLEEPING; p->chan does not change while it is there. The
+// queue lock is taken before p->lock.
+#define NSLEEPQ_LOG 6
+#define NSLEEPQ (1 << NSLEEPQ_LOG)
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;      // via p->sleepnext
+};
+
+static struct sleepq sleepqs[NSLEEPQ];
+
+static struct sleepq*
+sleepq(void *chan)
+{
+  // Fibonacci hashing: channels are addresses, often aligned.
+  return &sleepqs[((uint64)chan * 0x9E3779B97F4A7C15UL) >> (64 - NSLEEPQ_LOG)];
+}
+
+// Each hart has a FIFO queue of RUNNABLE processes. A process
+// goes back on the queue of the hart it last ran on, whose
+// caches are warm for it; a hart whose queue is empty steals
+// from the longest other queue. p->lock is taken before a
+// queue lock, so the scheduler takes p off a queue first and
+// locks it afterwards.
+static void setrunnable(struct proc *p);
+
+extern pagetable_t kernel_pagetable; // vm.c
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static struct shrinker proc_shrinker;
+static void sib_add(struct proc **head, struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+// Trapframes are packed several to a page. A trapframe is
+// aligned to a power of two at least its size, so it never
+// straddles a page and the page holding it can be mapped
+// at TRAPFRAME. The neighbours that share the page are
+// mapped too, but without PTE_U, like p's own.
+#define TRAPFRAME_ALIGN 512
+static struct kmem_cache *trapframe_cache;
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// Make a new struct proc when the free list is empty. Its kernel
+// stack is mapped high in memory at a free slot, followed by an
+// invalid guard page. kvmmake() made the page-table pages for
+// all slots, so mapping does not allocate under ptable.lock,
+// which the proc shrinker takes. Returns 0 if out of memory or
+// slots.
+static struct proc*
+newproc(void)
 {
   struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  char *pa;
+  int slot;
+
+  if((p = kmem_cache_alloc(proc_cache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
+  p->state = UNUSED;
+  if((pa = kalloc()) == 0){
+    kmem_cache_free(proc_cache, p);
+    return 0;
+  }
+
+  acquire(&ptable.lock);
+  if(ptable.nfreeslot > 0)
+    slot = ptable.freeslot[--ptable.nfreeslot];
+  else if(ptable.nslot < NPROC)
+    slot = ptable.nslot++;
+  else
+    slot = -1;
+  if(slot < 0 ||
+     mappages(kernel_pagetable, KSTACK(slot), PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    if(slot >= 0)
+      ptable.freeslot[ptable.nfreeslot++] = slot;
+    release(&ptable.lock);
+    kfree(pa);
+    kmem_cache_free(proc_cache, p);
+    return 0;
   }
+  p->kstack = KSTACK(slot);
+  ptable.kstackgen++;
+  p->allprev = 0;
+  p->allnext = ptable.all;
+  if(ptable.all)
+    ptable.all->allprev = p;
+  ptable.all = p;
+  release(&ptable.lock);
+
+  return p;
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
+  initlock(&ptable.lock, "ptable");
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepqs[i].lock, "sleepq");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&cpus[i].rqlock, "runq");
+  proc_cache = kmem_cache_create("proc", sizeof(struct proc), 0, 0, 0);
+  if(proc_cache == 0)
+    panic("procinit");
+  if(sizeof(struct trapframe) > TRAPFRAME_ALIGN)
+    panic("procinit: trapframe");
+  trapframe_cache = kmem_cache_create("trapframe", sizeof(struct trapframe), TRAPFRAME_ALIGN, 0, 0);
+  if(trapframe_cache == 0)
+    panic("procinit");
+  register_shrinker(&proc_shrinker);
 }
 
 // Must be called with interrupts disabled,
@@ -89,44 +195,59 @@ myproc(void)
   return p;
 }
 
-int
-allocpid()
+// Give p a new pid and enter it in the pid hash.
+static void
+allocpid(struct proc *p)
 {
-  int pid;
-  
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
   release(&pid_lock);
+}
 
-  return pid;
+static void
+freepid(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pid_lock);
+  p->pidnext = 0;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
+// Take an UNUSED proc from the free list, or make a new one.
+// Initialize state required to run in the kernel,
 // and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// If a memory allocation fails, return 0.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  acquire(&ptable.lock);
+  if((p = ptable.free) != 0){
+    ptable.free = p->nextfree;
+    ptable.nfree--;
   }
-  return 0;
+  release(&ptable.lock);
+  if(p == 0 && (p = newproc()) == 0)
+    return 0;
 
-found:
-  p->pid = allocpid();
+  acquire(&p->lock);
+  allocpid(p);
   p->state = USED;
+  p->cpu = cpuid();  // start on the hart that made it
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  // Allocate a trapframe.
+  if((p->trapframe = kmem_cache_alloc(trapframe_cache)) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -156,12 +277,14 @@ static void
 freeproc(struct proc *p)
 {
   if(p->trapframe)
-    kfree((void*)p->trapframe);
+    kmem_cache_free(trapframe_cache, p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  if(p->pid)
+    freepid(p);
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -169,8 +292,75 @@ freeproc(struct proc *p)
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
+
+  acquire(&ptable.lock);
+  p->nextfree = ptable.free;
+  ptable.free = p;
+  ptable.nfree++;
+  release(&ptable.lock);
+}
+
+// The proc shrinker: frees free procs and their kernel stacks.
+static uint64
+proc_count(void)
+{
+  return ptable.nfree;
 }
 
+static uint64
+proc_scan(uint64 n)
+{
+  struct proc *p, **pp, *list = 0;
+  uint64 pages = 0;
+
+  // A free proc is out of the pid hash, but kill() may have
+  // found it just before; it is left alone until kill is done.
+  acquire(&ptable.lock);
+  acquire(&pid_lock);
+  for(pp = &ptable.free; pages < n && (p = *pp) != 0; ){
+    if(p->killers){
+      pp = &p->nextfree;
+      continue;
+    }
+    *pp = p->nextfree;
+    ptable.nfree--;
+    if(p->allprev)
+      p->allprev->allnext = p->allnext;
+    else
+      ptable.all = p->allnext;
+    if(p->allnext)
+      p->allnext->allprev = p->allprev;
+    p->nextfree = list;
+    list = p;
+    pages++;
+  }
+  release(&pid_lock);
+  release(&ptable.lock);
+
+  // Other harts may still have the stacks in their TLBs,
+  // but no one uses them, and a hart flushes before it runs
+  // a process whose stack reuses a slot.
+  for(p = list; p; p = p->nextfree)
+    uvmunmap(kernel_pagetable, p->kstack, 1, 1);
+  sfence_vma();
+
+  acquire(&ptable.lock);
+  for(p = list; p; p = p->nextfree)
+    ptable.freeslot[ptable.nfreeslot++] = (TRAMPOLINE - p->kstack) / (2*PGSIZE) - 1;
+  release(&ptable.lock);
+
+  while((p = list) != 0){
+    list = p->nextfree;
+    kmem_cache_free_bulk(proc_cache, 1, (void**)&p);
+  }
+  return pages + kmem_cache_shrink(proc_cache);
+}
+
+static struct shrinker proc_shrinker = {
+  .count = proc_count,
+  .scan = proc_scan,
+};
+
 // Create a user page table for a given process, with no user memory,
 // but with trampoline and trapframe pages.
 pagetable_t
@@ -193,10 +383,10 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe page just below the trampoline page, for
-  // trampoline.S.
+  // map the page holding the trapframe just below the
+  // trampoline page, for trampoline.S.
   if(mappages(pagetable, TRAPFRAME, PGSIZE,
-              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+              PGROUNDDOWN((uint64)p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
@@ -249,7 +439,7 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
@@ -316,15 +506,41 @@ fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  sib_add(&p->children, np);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Each process keeps its live children and its zombie
+// children on two lists, so wait() and exit() only touch
+// the processes concerned. Caller must hold wait_lock.
+static void
+sib_add(struct proc **head, struct proc *p)
+{
+  p->prevsib = 0;
+  p->nextsib = *head;
+  if(*head)
+    (*head)->prevsib = p;
+  *head = p;
+}
+
+static void
+sib_remove(struct proc **head, struct proc *p)
+{
+  if(p->prevsib)
+    p->prevsib->nextsib = p->nextsib;
+  else
+    *head = p->nextsib;
+  if(p->nextsib)
+    p->nextsib->prevsib = p->prevsib;
+  p->nextsib = p->prevsib = 0;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -332,12 +548,19 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0 && p->zombies == 0)
+    return;
+  while((pp = p->children) != 0){
+    sib_remove(&p->children, pp);
+    pp->parent = initproc;
+    sib_add(&initproc->children, pp);
+  }
+  while((pp = p->zombies) != 0){
+    sib_remove(&p->zombies, pp);
+    pp->parent = initproc;
+    sib_add(&initproc->zombies, pp);
   }
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -370,6 +593,10 @@ exit(int status)
   // Give any children to init.
   reparent(p);
 
+  // Let the parent's wait() find p.
+  sib_remove(&p->parent->children, p);
+  sib_add(&p->parent->zombies, p);
+
   // Parent might be sleeping in wait().
   wakeup(p->parent);
   
@@ -391,40 +618,33 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int pid;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
-          release(&pp->lock);
-          release(&wait_lock);
-          return pid;
-        }
+    // exit() moves a child to p->zombies.
+    if((pp = p->zombies) != 0){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      pid = pp->pid;
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                              sizeof(pp->xstate)) < 0) {
         release(&pp->lock);
+        release(&wait_lock);
+        return -1;
       }
+      sib_remove(&p->zombies, pp);
+      freeproc(pp);
+      release(&pp->lock);
+      release(&wait_lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(p->children == 0 || killed(p)){
       release(&wait_lock);
       return -1;
     }
@@ -434,6 +654,76 @@ wait(uint64 addr)
   }
 }
 
+// Put p on the run queue of the hart it last ran on.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c = &cpus[p->cpu];
+
+  p->state = RUNNABLE;
+  p->rqnext = 0;
+  acquire(&c->rqlock);
+  if(c->rqtail)
+    c->rqtail->rqnext = p;
+  else
+    c->rqhead = p;
+  c->rqtail = p;
+  c->rqlen++;
+  release(&c->rqlock);
+}
+
+// Queue lengths are peeked at without the lock, so that idle
+// harts only take the locks of queues that have work.
+static int
+rqlen(struct cpu *c)
+{
+  return __atomic_load_n(&c->rqlen, __ATOMIC_RELAXED);
+}
+
+// Take the first process off rq's queue, or return 0.
+// self is the hart asking, for its counters.
+static struct proc*
+runq_pop(struct cpu *rq, struct cpu *self)
+{
+  struct proc *p;
+
+  acquire(&rq->rqlock);
+  self->nlock++;
+  if((p = rq->rqhead) != 0){
+    rq->rqhead = p->rqnext;
+    if(rq->rqhead == 0)
+      rq->rqtail = 0;
+    rq->rqlen--;
+    p->rqnext = 0;
+  }
+  release(&rq->rqlock);
+  return p;
+}
+
+// Own queue first; if it is empty, steal from the longest.
+static struct proc*
+runq_next(struct cpu *c)
+{
+  struct cpu *busiest = 0;
+  struct proc *p;
+  int len, max = 0;
+
+  if(rqlen(c) > 0 && (p = runq_pop(c, c)) != 0)
+    return p;
+  for(struct cpu *o = cpus; o < &cpus[NCPU]; o++){
+    if(o != c && (len = rqlen(o)) > max){
+      max = len;
+      busiest = o;
+    }
+  }
+  if(busiest && (p = runq_pop(busiest, c)) != 0){
+    c->nsteal++;
+    return p;
+  }
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -452,22 +742,34 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = runq_next(c)) == 0)
+      continue;
+
+    // Waits until p's previous hart has switched away from it.
+    acquire(&p->lock);
+    c->nlock++;
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+
+    // newproc() may have mapped kernel stacks since this
+    // hart last flushed its TLB, maybe in reused slots.
+    if(c->kstackgen != ptable.kstackgen){
+      c->kstackgen = ptable.kstackgen;
+      sfence_vma();
     }
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = c - cpus;
+    c->proc = p;
+    c->nswitch++;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -504,7 +806,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -536,24 +838,29 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = sleepq(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold q->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks q->lock),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&q->lock);  //DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sleepnext = q->head;
+  q->head = p;
+  release(&q->lock);
 
   sched();
 
-  // Tidy up.
+  // Tidy up. Whoever woke us took us off the queue.
   p->chan = 0;
 
   // Reacquire original lock.
@@ -561,22 +868,35 @@ sleep(void *chan, struct spinlock *lk)
   acquire(lk);
 }
 
-// Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
-void
-wakeup(void *chan)
+// Wake the processes sleeping on chan, or only target if
+// it is not 0.
+static void
+wakeq(void *chan, struct proc *target)
 {
-  struct proc *p;
+  struct sleepq *q = sleepq(chan);
+  struct proc *p, **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&q->lock);
+  for(pp = &q->head; (p = *pp) != 0; ){
+    if(p->chan == chan && (target == 0 || p == target)){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
+      *pp = p->sleepnext;
+      p->sleepnext = 0;
+      setrunnable(p);
       release(&p->lock);
+    } else {
+      pp = &p->sleepnext;
     }
   }
+  release(&q->lock);
+}
+
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void
+wakeup(void *chan)
+{
+  wakeq(chan, 0);
 }
 
 // Kill the process with the given pid.
@@ -586,21 +906,40 @@ int
 kill(int pid)
 {
   struct proc *p;
+  void *chan;
+  int found;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  if(p == 0){
+    release(&pid_lock);
+    return -1;
   }
-  return -1;
+  // keeps the proc shrinker from freeing p meanwhile.
+  p->killers++;
+  release(&pid_lock);
+
+  // p->lock comes before pid_lock (see allocproc), so
+  // check again that p did not exit in between.
+  acquire(&p->lock);
+  found = p->pid == pid;
+  if(found)
+    p->killed = 1;
+  chan = found && p->state == SLEEPING ? p->chan : 0;
+  release(&p->lock);
+  acquire(&pid_lock);
+  p->killers--;
+  release(&pid_lock);
+  if(!found)
+    return -1;
+
+  // Wake process from sleep(). The queue lock comes before
+  // p->lock; if p has woken up since, this does nothing.
+  if(chan)
+    wakeq(chan, p);
+  return 0;
 }
 
 void
@@ -654,7 +993,8 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Only ptable.lock, which keeps procs from being freed; no
+// p->lock, to avoid wedging a stuck machine further.
 void
 procdump(void)
 {
@@ -670,7 +1010,8 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  acquire(&ptable.lock);
+  for(p = ptable.all; p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -680,4 +1021,11 @@ procdump(void)
     printf("%d %s %s", p->pid, state, p->name);
     printf("\n");
   }
+  release(&ptable.lock);
+  for(struct cpu *c = cpus; c < &cpus[NCPU]; c++){
+    if(c->nswitch == 0)
+      continue;
+    printf("hart %d: %d queued, %d switches, %d steals, %d scheduler locks\n",
+           (int)(c - cpus), c->rqlen, (int)c->nswitch, (int)c->nsteal, (int)c->nlock);
+  }
 }
@@ -24,13 +24,27 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 kstackgen;           // ptable.kstackgen when this TLB was last flushed.
+
+  // Run queue of RUNNABLE processes, via p->rqnext.
+  struct spinlock rqlock;
+  struct proc *rqhead;
+  struct proc *rqtail;
+  int rqlen;
+
+  // Scheduler counters, shown by procdump().
+  uint64 nswitch;             // Processes switched to.
+  uint64 nsteal;              // Of those, taken from another hart's queue.
+  uint64 nlock;               // Locks the scheduler acquired to find them.
 };
 
 extern struct cpu cpus[NCPU];
 
 // per-process data for the trap handling code in trampoline.S.
-// sits in a page by itself just under the trampoline page in the
-// user page table. not specially mapped in the kernel page table.
+// comes from a slab cache, several to a page. the page holding it
+// is mapped just under the trampoline page in the user page table,
+// and userret leaves the trapframe's user address in sscratch.
+// not specially mapped in the kernel page table.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
 // kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
@@ -92,15 +106,28 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // Live children, via nextsib
+  struct proc *zombies;        // Exited children not yet waited for
+  struct proc *nextsib;        // In parent's children or zombies
+  struct proc *prevsib;
+
+  struct proc *allnext;        // In ptable.all; ptable.lock
+  struct proc *allprev;
+  struct proc *nextfree;       // In ptable.free; ptable.lock
+  struct proc *pidnext;        // In the pid hash chain; pid_lock
+  int killers;                 // kill() calls using p; pid_lock
+  struct proc *sleepnext;      // In the sleep queue of chan; its lock
+  struct proc *rqnext;         // In a hart's run queue; its rqlock
+  int cpu;                     // Hart that last ran it; its run queue
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   //uint64 
   pagetable_t pagetable;       // User page table
-  struct trapframe *trapframe; // data page for trampoline.S
+  struct trapframe *trapframe; // data for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -0,0 +1,11 @@
+// A subsystem that keeps memory it could give back to the
+// buddy allocator (empty slab pages, clean buffers, ...)
+// registers a shrinker. When buddy_alloc runs out of memory,
+// buddy_reclaim calls the shrinkers before it gives up.
+// count and scan are called without allocator locks held.
+struct shrinker {
+  uint64 (*count)(void);      // about how many pages scan could free now
+  uint64 (*scan)(uint64 n);   // free about n pages; returns pages
+                              // actually given back to buddy_free
+  struct shrinker *next;      // registered shrinkers; set by register_shrinker
+};
@@ -5,92 +5,499 @@
 #include "riscv.h"
 #include "defs.h"
 #include "lib/slab_alloc/slab_alloc.h"
+#include "buddy_alloc.h"
+#include "shrinker.h"
 
-// #include "slab_alloc.h"
-#include "virtio.h"
-#include "pipe.h"
+// Objects are cached per hart in magazines, as in Bonwick's
+// "Magazines and Vmem" paper. Each hart has a loaded and a
+// previous magazine per cache and allocates and frees through
+// them with interrupts off and no locks. Only when both are
+// empty (on alloc) or full (on free) does it take the cache
+// lock to exchange a magazine with the cache's depot, or fall
+// through to the slab layer.
+#define MAG_ROUNDS 14
 
-typedef struct{
+struct magazine {
+    struct magazine* next;      // in a depot list
+    int rounds;                 // number of objects in objs
+    void* objs[MAG_ROUNDS];
+};
+
+// Per-hart state of one cache. A hart only touches its own entry,
+// and the entries are cache-line aligned like buddy_stat.
+struct kslab_cpu {
+    struct magazine* loaded;
+    struct magazine* previous;  // always full or empty; 0 if loaded is 0
+    uint64 allocs;
+    uint64 frees;
+    uint64 failures;
+    uint64 spins;
+} __attribute__((aligned(CACHELINE)));
+
+// A cache of objects of one type, created by kmem_cache_create.
+struct kmem_cache {
+    struct spinlock lock;       // protects slab and the depot
+    slab_alloc_t slab;
+    struct magazine* full;      // depot of full magazines
+    struct magazine* empty;     // depot of empty magazines
+    char* name;
+    uint size;                  // object size asked for
+    struct kmem_cache* next;    // in the registry; protected by registry.lock
+    struct kslab_cpu cpu[NCPU];
+};
+
+// All caches, for reclaim and statistics.
+struct {
+    struct spinlock lock;
+    struct kmem_cache* head;
+} registry;
+
+// struct kmem_cache objects themselves come from this cache.
+static struct kmem_cache cache_cache;
+
+// Magazines themselves come from a plain slab cache.
+struct {
     struct spinlock lock;
     slab_alloc_t slab;
-} kslab_alloc_t;
+} mag_cache;
 
 
+// A slab may span several pages, so ask the buddy
+// allocator where the block holding ptr starts.
 static void* pgbegin(void* ptr){
-    uint64 x = (uint64) ptr;
-    return ptr - x % PGSIZE;
+    return buddy_block_start(ptr);
+}
+
+// Returns ptr to the slab layer. The slab and its owner are
+// found directly instead of through the pgbegin callback.
+static void slab_put(void* ptr){
+    lib_slab_free_any(buddy_block_start(ptr), ptr);
+}
+
+static struct kmem_cache* owner_cache(void* ptr){
+    slab_alloc_t* owner = lib_slab_owner(buddy_block_start(ptr));
+    return (struct kmem_cache*)((char*)owner - __builtin_offsetof(struct kmem_cache, slab));
 }
 
 
+// Slab pages are allocated with a cache lock held, so the slab
+// layer must not trigger reclaim, which takes cache locks.
 static void kslab_init(
-    kslab_alloc_t* slab,
-    uint ssize
+    struct kmem_cache* slab,
+    char* name,
+    uint ssize,
+    uint align,
+    void (*ctor)(void*),
+    void (*dtor)(void*)
 ){
-    initlock(&slab->lock, "slab lock");
-    lib_slab_init(&slab->slab, PGSIZE, ssize, buddy_alloc, buddy_free, pgbegin);
+    initlock(&slab->lock, name);
+    lib_slab_init(&slab->slab, PGSIZE, ssize, align, buddy_alloc_noreclaim, buddy_free, pgbegin, ctor, dtor);
+    slab->full = 0;
+    slab->empty = 0;
+    slab->name = name;
+    slab->size = ssize;
+    memset(slab->cpu, 0, sizeof(slab->cpu));
+
+    acquire(&registry.lock);
+    slab->next = registry.head;
+    registry.head = slab;
+    release(&registry.lock);
 }
 
-static void* kslab_alloc(kslab_alloc_t* slab){
-    acquire(&slab->lock);
+static struct magazine* mag_new(void){
+    acquire(&mag_cache.lock);
+    struct magazine* m = lib_slab_alloc(&mag_cache.slab);
+    release(&mag_cache.lock);
+    if(m)
+        m->rounds = 0;
+    return m;
+}
+
+static void mag_free(struct magazine* m){
+    acquire(&mag_cache.lock);
+    slab_put(m);
+    release(&mag_cache.lock);
+}
+
+static struct magazine* depot_get(struct magazine** list){
+    struct magazine* m = *list;
+    if(m)
+        *list = m->next;
+    return m;
+}
+
+static void depot_put(struct magazine** list, struct magazine* m){
+    m->next = *list;
+    *list = m;
+}
+
+static void swap_mags(struct kslab_cpu* c){
+    struct magazine* m = c->loaded;
+    c->loaded = c->previous;
+    c->previous = m;
+}
+
+// Lock-free part of allocation; 0 if both magazines are empty.
+static void* cpu_alloc(struct kslab_cpu* c){
+    if(c->loaded && c->loaded->rounds > 0)
+        return c->loaded->objs[--c->loaded->rounds];
+    if(c->previous && c->previous->rounds > 0){
+        swap_mags(c);
+        return c->loaded->objs[--c->loaded->rounds];
+    }
+    return 0;
+}
+
+// Lock-free part of free; 0 if both magazines are full.
+static int cpu_free(struct kslab_cpu* c, void* ptr){
+    if(c->loaded && c->loaded->rounds < MAG_ROUNDS){
+        c->loaded->objs[c->loaded->rounds++] = ptr;
+        return 1;
+    }
+    if(c->previous && c->previous->rounds == 0){
+        swap_mags(c);
+        c->loaded->objs[c->loaded->rounds++] = ptr;
+        return 1;
+    }
+    return 0;
+}
+
+static void* kslab_alloc_slow(struct kmem_cache* slab, struct kslab_cpu* c){
+    c->spins += acquire_spin(&slab->lock);
+    struct magazine* m = depot_get(&slab->full);
+    if(m){
+        // both magazines are empty: keep one, return the other
+        if(c->previous)
+            depot_put(&slab->empty, c->previous);
+        c->previous = c->loaded;
+        c->loaded = m;
+        release(&slab->lock);
+        return c->loaded->objs[--c->loaded->rounds];
+    }
+
     void* res = lib_slab_alloc(&slab->slab);
     release(&slab->lock);
+    if(res == 0){
+        buddy_reclaim(1 << slab->slab.order);
+        c->spins += acquire_spin(&slab->lock);
+        res = lib_slab_alloc(&slab->slab);
+        release(&slab->lock);
+    }
     return res;
 }
 
-static void kslab_free(kslab_alloc_t* slab, void* ptr){
+static void kslab_free_slow(struct kmem_cache* slab, struct kslab_cpu* c, void* ptr){
+    c->spins += acquire_spin(&slab->lock);
+    struct magazine* m = depot_get(&slab->empty);
+    if(m == 0)
+        m = mag_new();
+    if(m){
+        // both magazines are full: hand one to the depot
+        if(c->previous)
+            depot_put(&slab->full, c->previous);
+        c->previous = c->loaded;
+        c->loaded = m;
+        c->loaded->objs[c->loaded->rounds++] = ptr;
+    } else {
+        slab_put(ptr);
+    }
+    release(&slab->lock);
+}
+
+static void* kslab_alloc(struct kmem_cache* slab){
+    push_off();
+    struct kslab_cpu* c = &slab->cpu[cpuid()];
+    void* res = cpu_alloc(c);
+    if(res == 0)
+        res = kslab_alloc_slow(slab, c);
+    if(res)
+        c->allocs += 1;
+    else
+        c->failures += 1;
+    pop_off();
+    return res;
+}
+
+static void kslab_free(struct kmem_cache* slab, void* ptr){
+    push_off();
+    struct kslab_cpu* c = &slab->cpu[cpuid()];
+    if(!cpu_free(c, ptr))
+        kslab_free_slow(slab, c, ptr);
+    c->frees += 1;
+    pop_off();
+}
+
+// About how many pages kslab_reap would free now: the reserve
+// of empty slabs and the pages that the objects sitting in
+// full depot magazines take up.
+static uint64 kslab_count(struct kmem_cache* slab){
+    uint64 bytes = 0;
+    acquire(&slab->lock);
+    for(struct magazine* m = slab->full; m; m = m->next)
+        bytes += m->rounds * slab->slab.ssize;
+    uint64 pages = ((uint64)slab->slab.empty.len << slab->slab.order) + bytes / PGSIZE;
+    release(&slab->lock);
+    return pages;
+}
+
+// Returns the objects of the depot's full magazines to the slab
+// layer, frees all depot magazines and then the reserve of empty
+// slab pages. Magazines loaded on harts are left alone: only their
+// own hart may touch them. Returns the number of pages freed.
+static uint64 kslab_reap(struct kmem_cache* slab){
+    struct magazine* m;
     acquire(&slab->lock);
-    lib_slab_free(&slab->slab, ptr);
+    while((m = depot_get(&slab->full)) != 0){
+        for(int i = 0; i < m->rounds; i++)
+            slab_put(m->objs[i]);
+        mag_free(m);
+    }
+    while((m = depot_get(&slab->empty)) != 0)
+        mag_free(m);
+    uint64 pages = (uint64)lib_slab_shrink(&slab->slab, 0) << slab->slab.order;
     release(&slab->lock);
+    return pages;
+}
+
+// Adds the counters of one cache to the slab_* fields of info.
+static void kslab_stat(struct kmem_cache* slab, struct buddy_info* info){
+    for(int i = 0; i < NCPU; i++){
+        struct kslab_cpu* c = &slab->cpu[i];
+        info->slab_allocs += c->allocs;
+        info->slab_frees += c->frees;
+        info->slab_failures += c->failures;
+        info->slab_spins += c->spins;
+    }
+}
+
+
+
+
+// The slab layer's shrinker: trims the depots and the empty-page
+// reserves of the caches until n pages are freed.
+static uint64 slab_count(void){
+    uint64 pages = 0;
+    acquire(&registry.lock);
+    for(struct kmem_cache* c = registry.head; c; c = c->next)
+        pages += kslab_count(c);
+    release(&registry.lock);
+
+    acquire(&mag_cache.lock);
+    pages += (uint64)mag_cache.slab.empty.len << mag_cache.slab.order;
+    release(&mag_cache.lock);
+    return pages;
+}
+
+static uint64 slab_scan(uint64 n){
+    uint64 pages = 0;
+    acquire(&registry.lock);
+    for(struct kmem_cache* c = registry.head; c && pages < n; c = c->next)
+        pages += kslab_reap(c);
+    release(&registry.lock);
+
+    // Reaping frees magazines, so shrink their cache last.
+    acquire(&mag_cache.lock);
+    pages += (uint64)lib_slab_shrink(&mag_cache.slab, 0) << mag_cache.slab.order;
+    release(&mag_cache.lock);
+    return pages;
 }
 
+static struct shrinker slab_shrinker = {
+    .count = slab_count,
+    .scan = slab_scan,
+};
 
 
+// kmalloc size classes: KMALLOC_MIN << i bytes.
+static struct kmem_cache* kmalloc_caches[KMALLOC_CLASSES];
 
-kslab_alloc_t slab_virtq_desc;
-kslab_alloc_t slab_virtq_avail;
-kslab_alloc_t slab_virtq_used;
-kslab_alloc_t slab_pipe;
+static char* kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
 
 
 void slab_init(){
-    kslab_init(&slab_virtq_desc, sizeof(struct virtq_desc));
-    kslab_init(&slab_virtq_avail, sizeof(struct virtq_avail));
-    kslab_init(&slab_virtq_used, sizeof(struct virtq_used));
-    kslab_init(&slab_pipe, sizeof(struct pipe));
-}
-
-
-
-void* slab_alloc(int slab_struct){
-    void* res = 0;
-    if(slab_struct == SLAB_virtq_desc)
-        res = kslab_alloc(&slab_virtq_desc);
-    else if(slab_struct == SLAB_virtq_avail)
-        res = kslab_alloc(&slab_virtq_avail);
-    else if(slab_struct == SLAB_virtq_used)
-        res = kslab_alloc(&slab_virtq_used);
-    else if(slab_struct == SLAB_pipe)
-        res = kslab_alloc(&slab_pipe);
-    else 
-        panic("slab alloc");
+    initlock(&registry.lock, "slab registry");
+    initlock(&mag_cache.lock, "magazines");
+    lib_slab_init(&mag_cache.slab, PGSIZE, sizeof(struct magazine), CACHELINE, buddy_alloc_noreclaim, buddy_free, pgbegin, 0, 0);
+    kslab_init(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), CACHELINE, 0, 0);
+
+    for(int i = 0; i < KMALLOC_CLASSES; i++){
+        uint size = KMALLOC_MIN << i;
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], size, size < CACHELINE ? size : CACHELINE, 0, 0);
+        if(kmalloc_caches[i] == 0)
+            panic("slab_init");
+    }
+    register_shrinker(&slab_shrinker);
+}
+
+// Creates a cache of size-byte objects aligned to align (a power
+// of two, 0 for the default). If ctor is not 0, it runs once per
+// object, and objects must be freed in the constructed state. If
+// dtor is not 0, it runs on every object ever handed out from a
+// slab before the slab goes back to the buddy allocator.
+// Returns 0 if out of memory.
+struct kmem_cache* kmem_cache_create(char* name, uint size, uint align, void (*ctor)(void*), void (*dtor)(void*)){
+    struct kmem_cache* cache = kslab_alloc(&cache_cache);
+    if(cache)
+        kslab_init(cache, name, size, align, ctor, dtor);
+    return cache;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache){
+    return kslab_alloc(cache);
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* ptr){
+    kslab_free(cache, ptr);
+}
+
+// Allocates up to n objects into out with one acquisition of the
+// cache lock, straight from the slabs rather than the magazines.
+// Returns how many were allocated; fewer than n only if out of memory.
+uint kmem_cache_alloc_bulk(struct kmem_cache* cache, uint n, void** out){
+    push_off();
+    struct kslab_cpu* c = &cache->cpu[cpuid()];
+    c->spins += acquire_spin(&cache->lock);
+    uint res = lib_slab_alloc_bulk(&cache->slab, n, out);
+    release(&cache->lock);
+    if(res < n){
+        uint slabs = (n - res + cache->slab.cells - 1) / cache->slab.cells;
+        buddy_reclaim((uint64)slabs << cache->slab.order);
+        c->spins += acquire_spin(&cache->lock);
+        res += lib_slab_alloc_bulk(&cache->slab, n - res, out + res);
+        release(&cache->lock);
+    }
+    c->allocs += res;
+    if(res < n)
+        c->failures += 1;
+    pop_off();
     return res;
 }
 
+// Gives the depot and the empty slabs of cache back to the buddy
+// allocator, for shrinkers that have just freed objects of it.
+// Objects freed with kmem_cache_free_bulk are in the slabs already;
+// those in magazines loaded on harts are not reached. Returns the
+// number of pages freed.
+uint64 kmem_cache_shrink(struct kmem_cache* cache){
+    uint64 pages = kslab_reap(cache);
+    acquire(&mag_cache.lock);
+    pages += (uint64)lib_slab_shrink(&mag_cache.slab, 0) << mag_cache.slab.order;
+    release(&mag_cache.lock);
+    return pages;
+}
+
+// Frees n objects of cache with one acquisition of its lock.
+// Cheapest when objects from the same slab are adjacent in ptrs.
+void kmem_cache_free_bulk(struct kmem_cache* cache, uint n, void** ptrs){
+    push_off();
+    struct kslab_cpu* c = &cache->cpu[cpuid()];
+    c->spins += acquire_spin(&cache->lock);
+    lib_slab_free_bulk(&cache->slab, n, ptrs);
+    release(&cache->lock);
+    c->frees += n;
+    pop_off();
+}
+
 
-void slab_free(int slab_struct, void* ptr){
-    if(slab_struct == SLAB_virtq_desc)
-        kslab_free(&slab_virtq_desc, ptr);
-    else if(slab_struct == SLAB_virtq_avail)
-        kslab_free(&slab_virtq_avail, ptr);
-    else if(slab_struct == SLAB_virtq_used)
-        kslab_free(&slab_virtq_used, ptr);
-    else if(slab_struct == SLAB_pipe)
-        kslab_free(&slab_pipe, ptr);
-    else 
-        panic("slab free");
+// Sums the per-hart counters of all caches for sys_buddy_info.
+void slab_stat(struct buddy_info* info){
+    acquire(&registry.lock);
+    for(struct kmem_cache* c = registry.head; c; c = c->next)
+        kslab_stat(c, info);
+    release(&registry.lock);
 }
 
 
+// Fills the fields of info that the slab layer knows and returns
+// the number of objects taken out of the slabs. The caller holds
+// the lock that protects slab.
+static uint64 slab_fill_info(slab_alloc_t* slab, char* name, uint size, struct slab_info* info){
+    uint64 used;
+    memset(info, 0, sizeof(*info));
+    safestrcpy(info->name, name, sizeof(info->name));
+    info->size = size;
+    info->cell = slab->ssize;
+    info->per_slab = slab->cells;
+    info->slab_pages = 1 << slab->order;
+    lib_slab_stat(slab, &used, &info->slabs, &info->partial, &info->empty);
+    return used;
+}
 
+// Fills info for one cache. Magazines loaded on other harts may be
+// swapped out and freed at any time, so they are not looked into:
+// objects in use are allocs minus frees, and the rest of those
+// taken out of the slabs sit in magazines. The per-hart counters
+// are read racily, so the split may be a bit off.
+static void kslab_info(struct kmem_cache* slab, struct slab_info* info){
+    acquire(&slab->lock);
+    uint64 used = slab_fill_info(&slab->slab, slab->name, slab->size, info);
+    release(&slab->lock);
 
+    for(int i = 0; i < NCPU; i++){
+        info->allocs += slab->cpu[i].allocs;
+        info->frees += slab->cpu[i].frees;
+    }
+    info->active = info->allocs > info->frees ? info->allocs - info->frees : 0;
+    if(info->active > used)
+        info->active = used;
+    info->cached = used - info->active;
+    info->waste = info->slabs * info->slab_pages * PGSIZE - info->active * info->size;
+}
 
+// The magazines' own cache is not a kmem_cache, so it is reported
+// separately, as the last entry.
+static void mag_info(struct slab_info* info){
+    acquire(&mag_cache.lock);
+    info->active = slab_fill_info(&mag_cache.slab, "magazine", sizeof(struct magazine), info);
+    release(&mag_cache.lock);
+    info->waste = info->slabs * info->slab_pages * PGSIZE - info->active * info->size;
+}
+
+uint64 sys_slab_info(void){
+    uint64 buf;
+    int n;
+    argaddr(0, &buf);
+    argint(1, &n);
+
+    struct slab_info info;
+    int count = 0;
+    acquire(&registry.lock);
+    for(struct kmem_cache* c = registry.head; c; c = c->next, count++){
+        if(count >= n)
+            continue;
+        kslab_info(c, &info);
+        if(either_copyout(1, buf + count * sizeof(info), &info, sizeof(info)) < 0){
+            release(&registry.lock);
+            return -1;
+        }
+    }
+    release(&registry.lock);
+
+    if(count < n){
+        mag_info(&info);
+        if(either_copyout(1, buf + count * sizeof(info), &info, sizeof(info)) < 0)
+            return -1;
+    }
+    return count + 1;
+}
+
+
+// Allocates size <= KMALLOC_MAX bytes from the smallest
+// size class that fits.
+void* slab_kmalloc(uint64 size){
+    int i = 0;
+    while((KMALLOC_MIN << i) < size)
+        i++;
+    if(i >= KMALLOC_CLASSES)
+        panic("slab_kmalloc");
+    return kslab_alloc(kmalloc_caches[i]);
+}
+
+// Frees an object of any slab cache. The cache is found
+// from the header of the slab that contains ptr.
+void slab_free_any(void* ptr){
+    kslab_free(owner_cache(ptr), ptr);
+}
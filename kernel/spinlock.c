@@ -21,6 +21,17 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  acquire_spin(lk);
+}
+
+// Like acquire(), but returns the number of times
+// the lock was found busy before it was taken.
+// Used by the allocators' contention counters.
+uint64
+acquire_spin(struct spinlock *lk)
+{
+  uint64 spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
@@ -30,7 +41,7 @@ acquire(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    spins++;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +51,8 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  return spins;
 }
 
 // Release the lock.
@@ -103,6 +103,7 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_dummy(void);
 extern uint64 sys_buddy_info(void);
+extern uint64 sys_slab_info(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -130,6 +131,7 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_dummy]   sys_dummy,
 [SYS_buddy_info]   sys_buddy_info,
+[SYS_slab_info]    sys_slab_info,
 };
 
 void
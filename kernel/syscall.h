@@ -23,4 +23,5 @@
 #define SYS_dummy  22
 
 #define SYS_buddy_info  23
+#define SYS_slab_info   24
 
@@ -451,18 +451,29 @@ sys_chdir(void)
   return 0;
 }
 
+// exec's arguments are copied back to back into one kmalloc
+// buffer. It starts small and doubles whenever an argument does
+// not fit in what is left; the strings have to fit in the
+// one-page user stack anyway.
+#define EXECARGS_MIN 256
+#define EXECARGS_MAX PGSIZE
+
 uint64
 sys_exec(void)
 {
-  char path[MAXPATH], *argv[MAXARG];
-  int i;
+  char path[MAXPATH], *argv[MAXARG], *buf, *nbuf;
+  uint off[MAXARG], size, used;
+  int i, n;
   uint64 uargv, uarg;
 
   argaddr(1, &uargv);
   if(argstr(0, path, MAXPATH) < 0) {
     return -1;
   }
-  memset(argv, 0, sizeof(argv));
+  size = EXECARGS_MIN;
+  used = 0;
+  if((buf = kmalloc(size)) == 0)
+    return -1;
   for(i=0;; i++){
     if(i >= NELEM(argv)){
       goto bad;
@@ -470,27 +481,32 @@ sys_exec(void)
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
       goto bad;
     }
-    if(uarg == 0){
-      argv[i] = 0;
+    if(uarg == 0)
       break;
+    // fetchstr fails if the string does not fit, or if uarg is bad.
+    while((n = fetchstr(uarg, buf + used, size - used)) < 0){
+      if(size >= EXECARGS_MAX || (nbuf = kmalloc(2*size)) == 0)
+        goto bad;
+      memmove(nbuf, buf, used);
+      kfree(buf);
+      buf = nbuf;
+      size *= 2;
     }
-    argv[i] = kalloc();
-    if(argv[i] == 0)
-      goto bad;
-    if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+    // buf may still move, so remember offsets.
+    off[i] = used;
+    used += n + 1;
   }
+  for(n = 0; n < i; n++)
+    argv[n] = buf + off[n];
+  argv[i] = 0;
 
   int ret = exec(path, argv);
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-
+  kfree(buf);
   return ret;
 
  bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  kfree(buf);
   return -1;
 }
 
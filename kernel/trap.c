@@ -119,14 +119,16 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
+  // tell trampoline.S the user page table to switch to,
+  // and where p->trapframe is in it.
   uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 trapframe = TRAPFRAME + ((uint64)p->trapframe & (PGSIZE - 1));
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(trapframe, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -117,18 +117,17 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
 
-  // allocate and zero queue memory.
-  disk.desc = slab_alloc(SLAB_virtq_desc); 
-  // disk.desc = kalloc();
-  disk.avail = slab_alloc(SLAB_virtq_avail);
-  // disk.avail = kalloc();
-  disk.used = slab_alloc(SLAB_virtq_used); 
-  // disk.used = kalloc();
+  // allocate and zero queue memory. kmalloc aligns to the
+  // size class up to 64 bytes, which covers the 16-, 2- and
+  // 4-byte alignment the rings need.
+  disk.desc = kmalloc(NUM * sizeof(struct virtq_desc));
+  disk.avail = kmalloc(sizeof(struct virtq_avail));
+  disk.used = kmalloc(sizeof(struct virtq_used));
   if(!disk.desc || !disk.avail || !disk.used)
     panic("virtio disk kalloc");
-  // memset(disk.desc, 0, PGSIZE);
-  // memset(disk.avail, 0, PGSIZE);
-  // memset(disk.used, 0, PGSIZE);
+  memset(disk.desc, 0, NUM * sizeof(struct virtq_desc));
+  memset(disk.avail, 0, sizeof(struct virtq_avail));
+  memset(disk.used, 0, sizeof(struct virtq_used));
 
   // set queue size.
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
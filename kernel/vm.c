@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "lib/buddy_alloc/buddy_alloc.h"
+#include "buddy_alloc.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +17,28 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// Per-hart cache of zeroed page-table pages. fork and exec
+// build whole page tables, so walk() takes pages from here
+// without the buddy lock or a memset; the cache is refilled
+// PTCACHE_BATCH pages at a time. freewalk() clears every
+// entry before it frees a table, so freed tables go back
+// already zeroed. A hart only touches its own cache, with
+// interrupts off. The caches are small enough to leave out
+// of reclaim: at most PTCACHE_MAX pages per hart.
+#define PTCACHE_MAX   16
+#define PTCACHE_BATCH 8
+
+struct ptcache {
+  int n;
+  void *pages[PTCACHE_MAX];
+  uint64 allocs;
+  uint64 cached;
+  uint64 refills;
+  uint64 time;
+} __attribute__((aligned(CACHELINE)));
+
+static struct ptcache ptcaches[NCPU];
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -43,9 +67,14 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
+  // kernel stacks are mapped by newproc() as
+  // processes are created. make the page-table pages
+  // for all the slots now, so that mapping a stack
+  // never allocates.
+  for(int i = 0; i < NPROC; i++)
+    if(walk(kpgtbl, KSTACK(i), 1) == 0)
+      panic("kvmmake");
+
   return kpgtbl;
 }
 
@@ -70,6 +99,104 @@ kvminithart()
   sfence_vma();
 }
 
+// Allocate a zeroed page-table page.
+// Returns 0 if out of memory.
+static pagetable_t
+ptalloc(void)
+{
+  void *pages[PTCACHE_BATCH];
+  struct ptcache *c;
+  uint64 start = r_time();
+  int n;
+
+  push_off();
+  c = &ptcaches[cpuid()];
+  c->allocs++;
+  if(c->n > 0){
+    pages[0] = c->pages[--c->n];
+    c->cached++;
+    c->time += r_time() - start;
+    pop_off();
+    return (pagetable_t)pages[0];
+  }
+  pop_off();
+
+  // refill and zero outside push_off(). if we move to
+  // another hart meanwhile, the spare pages just end up
+  // in that hart's cache.
+  n = buddy_alloc_bulk(PTCACHE_BATCH, pages);
+  if(n == 0 && (pages[0] = kalloc()) != 0)
+    n = 1;
+  for(int i = 0; i < n; i++){
+    memset(pages[i], 0, PGSIZE);
+    buddy_frame(pages[i])->flags = FRAME_PAGETABLE;
+  }
+
+  push_off();
+  c = &ptcaches[cpuid()];
+  c->refills++;
+  for(int i = 1; i < n; i++){
+    if(c->n < PTCACHE_MAX)
+      c->pages[c->n++] = pages[i];
+    else
+      kfree(pages[i]);
+  }
+  c->time += r_time() - start;
+  pop_off();
+  return n > 0 ? (pagetable_t)pages[0] : 0;
+}
+
+// Free a page-table page whose entries are all zero.
+static void
+ptfree(pagetable_t pagetable)
+{
+  struct ptcache *c;
+
+  push_off();
+  c = &ptcaches[cpuid()];
+  if(c->n < PTCACHE_MAX){
+    c->pages[c->n++] = pagetable;
+    pagetable = 0;
+  }
+  pop_off();
+  if(pagetable)
+    kfree(pagetable);
+}
+
+// Sums the per-hart counters for sys_buddy_info. No lock:
+// the counters only grow.
+void
+ptcache_stat(struct buddy_info *info)
+{
+  for(int i = 0; i < NCPU; i++){
+    info->pt_allocs += ptcaches[i].allocs;
+    info->pt_cached += ptcaches[i].cached;
+    info->pt_refills += ptcaches[i].refills;
+    info->pt_time += ptcaches[i].time;
+  }
+}
+
+// Record pte in the descriptor of the user page pa, as its
+// mapping, or forget it. A shared page has no single mapping
+// to record.
+static void
+rmap_set(uint64 pa, pte_t *pte)
+{
+  struct buddy_frame *f = buddy_frame((void*)pa);
+  if(f){
+    f->flags = FRAME_USER;
+    f->rmap = f->refs == 1 ? (uint64)pte : 0;
+  }
+}
+
+static void
+rmap_clear(uint64 pa, pte_t *pte)
+{
+  struct buddy_frame *f = buddy_frame((void*)pa);
+  if(f && f->rmap == (uint64)pte)
+    f->rmap = 0;
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -93,9 +220,8 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = ptalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -156,6 +282,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
+    if(perm & PTE_U)
+      rmap_set(pa, pte);
     if(a == last)
       break;
     a += PGSIZE;
@@ -183,10 +311,11 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
+    uint64 pa = PTE2PA(*pte);
+    if(*pte & PTE_U)
+      rmap_clear(pa, pte);
+    if(do_free)
       kfree((void*)pa);
-    }
     *pte = 0;
   }
 }
@@ -196,12 +325,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
-  if(pagetable == 0)
-    return 0;
-  memset(pagetable, 0, PGSIZE);
-  return pagetable;
+  return ptalloc();
 }
 
 // Load the user initcode into address 0 of pagetable,
@@ -283,7 +407,7 @@ freewalk(pagetable_t pagetable)
       panic("freewalk: leaf");
     }
   }
-  kfree((void*)pagetable);
+  ptfree(pagetable);
 }
 
 // Free user memory pages,
@@ -317,6 +441,16 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
       panic("uvmcopy: page not present");
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
+    if((flags & PTE_W) == 0){
+      // share read-only pages, such as program text, instead
+      // of copying them; copyout() does not write to them.
+      buddy_get((void*)pa);
+      if(mappages(new, i, PGSIZE, pa, flags) != 0){
+        kfree((void*)pa);
+        goto err;
+      }
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -352,12 +486,18 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    // refuse read-only pages: uvmcopy() shares them between processes.
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
+       (*pte & PTE_W) == 0)
       return -1;
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -62,6 +62,8 @@ static void insert_block(buddy_free_block_t* base_block, buddy_free_block_t* new
     new_block->prev = base_block;
     new_block->next = base_block->next;
 
+    if(base_block->next)
+        base_block->next->prev = new_block;
     base_block->next = new_block;
 
     list->len += 1;
@@ -120,14 +122,18 @@ static void* get_page_ptr(buddy_allocator_t* mem, int page_number){
 
 // Сколько страниц нужно зарезервировать под служебные данные?
 static uint64_t get_serv_pages(int levels, uint64_t pgsize, uint64_t pages){
-    uint64_t serv_size = levels * sizeof(buddy_list_t) + pages;
+    uint64_t serv_size = levels * sizeof(buddy_list_t) + pages * (sizeof(buddy_frame_t) + 1);
     return serv_size / pgsize + 1;
 }
  
-// Заполняет всю таблицу состояний значениями BUDDY_NOTHING
+// Заполняет всю таблицу состояний значениями BUDDY_NOTHING, а описатели страниц нулями
 static void init_state_table(buddy_allocator_t* mem){
-    for(int i = 0; i < mem->pages; i++)
+    for(int i = 0; i < mem->pages; i++){
         mem->state_table[i] = BUDDY_NOTHING;
+        mem->frames[i].refs = 0;
+        mem->frames[i].flags = 0;
+        mem->frames[i].rmap = 0;
+    }
     // printf("init state table, %d\n", BUDDY_NOTHING);
 }
 
@@ -181,12 +187,17 @@ int lib_buddy_init(
         return -1;
 
 
+    // Описатели идут сразу за списками: размер списка кратен 8, так что они выровнены
+    mem->pages = pages - serv_pages;
     mem->lists = (buddy_list_t*)ptr;
-    mem->state_table = (char*) ptr + sizeof(buddy_list_t) * mem->levels;
+    mem->frames = (buddy_frame_t*)((char*) ptr + sizeof(buddy_list_t) * mem->levels);
+    mem->state_table = (char*)(mem->frames + mem->pages);
 
-    mem->pages = pages - serv_pages;
     mem->data = (char*) ptr + serv_pages * pgsize;
 
+    mem->splits = 0;
+    mem->merges = 0;
+
     // printf("buddy init: levels=%d, pgsize=%d, pages=%d, free_pages=%d\n", levels, pgsize, pages, mem->pages);
 
     init_state_table(mem);
@@ -236,6 +247,7 @@ static void* buddy_devide(buddy_allocator_t* mem, buddy_free_block_t* free_block
         // Вторую половину объявляем свободной, а первую продолжаем делить
         char* second_part = (char*)free_block + (mem->pgsize << initial_lvl);
         list_add( &mem->lists[initial_lvl], (buddy_free_block_t*)second_part);
+        mem->splits += 1;
     }
     return free_block;
 }
@@ -272,7 +284,11 @@ void* lib_buddy_alloc(buddy_allocator_t* mem, uint64_t pages){
     // 4
     int pn = get_page_number(mem, res_block);
     ASSERT(pn >= 0);
+    ASSERT(mem->frames[pn].refs == 0);
     mem->state_table[pn] = lvl;
+    mem->frames[pn].refs = 1;
+    mem->frames[pn].flags = 0;
+    mem->frames[pn].rmap = 0;
 
     // 5
     return res_block;
@@ -315,7 +331,7 @@ static void add_free_block(buddy_allocator_t* mem,  uint64_t pn, int lvl){
     */
     ASSERT(lvl < mem->levels);
     ASSERT(block_exists(mem, pn, lvl));
-    while(lvl < mem->levels){
+    while(lvl < mem->levels - 1){   // блоки верхнего уровня не склеиваются
         // 0
         ASSERT(block_exists(mem, pn, lvl));
         uint64_t npn = pn ^ (1LL << lvl);   // neighbour page number - номер первой страницы соседнего куска
@@ -341,13 +357,35 @@ static void add_free_block(buddy_allocator_t* mem,  uint64_t pn, int lvl){
 
         // 3
         lvl += 1;    
+        mem->merges += 1;
     }
     // В конце добавляем один большой кусок
     list_add(&mem->lists[lvl], get_page_ptr(mem, pn));
 }
 
 
-void lib_buddy_free(buddy_allocator_t* mem, void* addr){
+// По адресу выделенного блока возвращает номер его первой страницы. Если блока нет - паникует!
+static int get_allocated_page(buddy_allocator_t* mem, void* addr){
+    int pn = get_page_number(mem, addr);
+    my_assert(pn != -1, "buddy_free - address is not correct!");
+    my_assert(mem->state_table[pn] >= 0, "buddy_free - address is not correct!");
+    ASSERT(mem->state_table[pn] < mem->levels);
+    ASSERT(mem->frames[pn].refs > 0);
+    return pn;
+}
+
+// Освобождает выделенный блок, начинающийся в странице pn, и возвращает его уровень
+static int free_allocated_block(buddy_allocator_t* mem, int pn){
+    int lvl = mem->state_table[pn];
+    mem->state_table[pn] = BUDDY_NOTHING;
+    mem->frames[pn].refs = 0;
+    mem->frames[pn].flags = 0;
+    mem->frames[pn].rmap = 0;
+    add_free_block(mem, pn, lvl);
+    return lvl;
+}
+
+int lib_buddy_free(buddy_allocator_t* mem, void* addr){
     /*
     0) По адресу получаем корректный номер страницы, или понимаем что адрес 
         неправильный.
@@ -357,20 +395,57 @@ void lib_buddy_free(buddy_allocator_t* mem, void* addr){
     3) Склеиваем его (возможно нуль или несколько раз) и добавляем в список свободных участков
     */
 
-    // 0
-    int pn = get_page_number(mem, addr);
-    my_assert(pn != -1, "buddy_free - address is not correct!");
+    // 0, 1
+    int pn = get_allocated_page(mem, addr);
+    my_assert(mem->frames[pn].refs == 1, "buddy_free - block is shared!");
 
-    // 1
-    int lvl = mem->state_table[pn];
-    my_assert(lvl >= 0, "buddy_free - address is not correct!");
-    ASSERT(lvl < mem->levels);
-    
-    // 2
-    mem->state_table[pn] = BUDDY_NOTHING;
+    // 2, 3
+    return free_allocated_block(mem, pn);
+}
 
-    // 3
-    add_free_block(mem, pn, lvl);  
+
+void lib_buddy_get(buddy_allocator_t* mem, void* addr){
+    int pn = get_allocated_page(mem, addr);
+    mem->frames[pn].refs += 1;
+}
+
+int lib_buddy_put(buddy_allocator_t* mem, void* addr){
+    int pn = get_allocated_page(mem, addr);
+    mem->frames[pn].refs -= 1;
+    if(mem->frames[pn].refs > 0)
+        return BUDDY_NOTHING;
+    return free_allocated_block(mem, pn);
+}
+
+buddy_frame_t* lib_buddy_frame(buddy_allocator_t* mem, void* addr){
+    if((char*)addr < (char*)mem->data)
+        return 0;
+    uint64_t pn = ((char*)addr - (char*)mem->data) / mem->pgsize;
+    if(pn >= mem->pages)
+        return 0;
+    return &mem->frames[pn];
+}
+
+
+
+/*
+Если addr лежит в выделенном блоке уровня k с первой страницей s, то для уровней
+lvl < k кандидат (номер страницы addr, округлённый вниз до кратного 2^lvl) либо
+равен s, и тогда state_table[s] == k != lvl, либо лежит внутри блока, и тогда
+в таблице состояний у него BUDDY_NOTHING. На уровне k кандидат равен s.
+*/
+void* lib_buddy_block_start(buddy_allocator_t* mem, void* addr){
+    if((char*)addr < (char*)mem->data)
+        return 0;
+    uint64_t pn = ((char*)addr - (char*)mem->data) / mem->pgsize;
+    if(pn >= mem->pages)
+        return 0;
+    for(int lvl = 0; lvl < mem->levels; lvl++){
+        uint64_t start = pn & ~((1ULL << lvl) - 1);
+        if(mem->state_table[start] == lvl)
+            return get_page_ptr(mem, start);
+    }
+    return 0;
 }
 
 
@@ -11,6 +11,8 @@ buddy_allocator_t               тип, представляющий аллок
 lib_buddy_init      инициализирует buddy_allocator_t
 lib_buddy_alloc     выделение памяти
 lib_buddy_free      освобождение памяти
+lib_buddy_get, lib_buddy_put    счётчик ссылок на выделенный блок
+lib_buddy_frame     описатель страницы
 */
 
 
@@ -31,6 +33,7 @@ lib_buddy_free      освобождение памяти
 #ifdef XV6
     #include "kernel/types.h"
     typedef uint64 uint64_t;
+    typedef uint32 uint32_t;
 #else
     #include <stdint.h>
 #endif
@@ -66,10 +69,25 @@ typedef struct buddy_list{
 
 
 
+/*
+Описатель страницы (кадра). Они лежат плотным массивом frames, по одному на рабочую
+страницу. Для выделенного блока значим описатель его первой страницы: lib_buddy_alloc
+ставит refs = 1, а flags и rmap обнуляет. Что хранить во flags и rmap, решает
+пользователь аллокатора, сам аллокатор их не читает.
+*/
+typedef struct buddy_frame{
+    uint32_t refs;      // число ссылок на блок; 0 - блок свободен
+    uint32_t flags;     // чем занят блок
+    uint64_t rmap;      // где блок отображён, пока ссылка одна
+} buddy_frame_t;
+
+
+
 
 /*
 В первых нескольких страницах хранятся метаданные:
     - списки свободных блоков (поле lists)
+    - описатели страниц (поле frames)
     - таблица состояний (поле state_table)
 Остальные страницы рабочие.
 
@@ -92,10 +110,14 @@ typedef struct {
     uint64_t pgsize;    // размер страницы
 
     buddy_list_t* lists;    // массив списков свободных блоков, имеет размер levels; указывает также на начало метаданных
+    buddy_frame_t* frames;  // описатели страниц, имеет размер pages
     char* state_table;      // таблица состояний, имеет размер pages
 
     uint64_t pages;  // количество рабочих страниц
     void* data;      // указатель на первую рабочую страницу
+
+    uint64_t splits;    // сколько раз блок делился пополам при выделениях
+    uint64_t merges;    // сколько раз блок склеивался с соседом при освобождениях
 } buddy_allocator_t;
 
 
@@ -113,8 +135,25 @@ int lib_buddy_init(
 // Аллоцирует блок, состоящий из pages страниц; pages обязана быть степенью двойки. При какой-либо ошибке возвращает нулевой указатель
 void* lib_buddy_alloc(buddy_allocator_t* mem, uint64_t pages);
 
-// Освобождает ранее выделенный блок. Если не удалось - паникует!
-void lib_buddy_free(buddy_allocator_t* mem, void* addr);
+// Освобождает ранее выделенный блок и возвращает его уровень. Если не удалось или
+// на блок есть другие ссылки - паникует!
+int lib_buddy_free(buddy_allocator_t* mem, void* addr);
+
+// Добавляет ссылку на выделенный блок, начинающийся в addr
+void lib_buddy_get(buddy_allocator_t* mem, void* addr);
+
+// Убирает ссылку на выделенный блок, начинающийся в addr. Если это была последняя
+// ссылка, освобождает блок и возвращает его уровень, иначе возвращает BUDDY_NOTHING
+int lib_buddy_put(buddy_allocator_t* mem, void* addr);
+
+// Возвращает описатель страницы, в которой лежит addr, или нулевой указатель.
+// Ничего не меняет, поэтому её можно вызывать без блокировки.
+buddy_frame_t* lib_buddy_frame(buddy_allocator_t* mem, void* addr);
+
+// Возвращает начало выделенного блока, в котором лежит addr, или нулевой указатель.
+// Не меняет аллокатор и читает только таблицу состояний внутри этого блока, поэтому,
+// пока блок выделен, её можно вызывать без блокировки.
+void* lib_buddy_block_start(buddy_allocator_t* mem, void* addr);
 
 // Возвращает статистику об аллокаторе
 void lib_buddy_stat(buddy_allocator_t* mem, uint64_t* total, uint64_t* free, uint64_t* free_by_size);
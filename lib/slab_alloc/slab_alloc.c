@@ -45,36 +45,33 @@
 ///   Действия со списками   ///
 ////////////////////////////////
 
-typedef struct slab_page{
-    struct slab_page* next;
-    struct slab_page* prev;
-    struct slab_list* list;
-    uint used_cells;
-} slab_page_t;
-
-typedef struct slab_list{
-    slab_page_t head;
-    uint len;
-} slab_list_t;
-
-static void list_init(slab_list_t* list, uint used_cells){
+/*
+Свободные ячейки страницы образуют односвязный список (стек): в начале каждой
+свободной ячейки лежит номер следующей свободной ячейки. Поле free - голова
+этого списка. Ячейки с номерами >= fresh ещё ни разу не выделялись и в списке
+не лежат, поэтому новую страницу не нужно размечать целиком.
+Так выделение и освобождение ячейки работают за константу.
+*/
+#define SLAB_NONE ((uint)-1)
+
+static void list_init(slab_list_t* list, uint bit){
     list->head.prev = 0,
     list->head.next = 0,
     list->head.list = list;
-    list->head.used_cells = used_cells;
     list->len = 0;
+    list->bit = bit;
 }
 
 static void list_insert(slab_page_t* base_block, slab_page_t* new_block){
     slab_list_t* list = base_block->list;
 
-    ASSERT(list->head.used_cells == base_block->used_cells);
-    new_block->used_cells = list->head.used_cells;
     new_block->list = list;
 
     new_block->prev = base_block;
     new_block->next = base_block->next;
 
+    if(base_block->next)
+        base_block->next->prev = new_block;
     base_block->next = new_block;
 
     list->len += 1;
@@ -92,6 +89,7 @@ static void list_remove(slab_page_t* block){
     if(next)
         next->prev = prev;
 
+    block->list = 0;
     list->len -= 1;      
 }
 
@@ -100,16 +98,57 @@ static void list_add(slab_list_t* list, slab_page_t* new_block){
 }
 
 
-////////////////////////////////////////////////////////////////////////////////
-///   Получение по странице начала битмапов и ячеек для выделяемых структур  ///
-////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////
+///   Раскладывание страниц по корзинам  ///
+////////////////////////////////////////////
+
+// Номер старшего единичного бита; x != 0
+static int highest_bit(uint x){
+    int res = 0;
+    for(int step = 16; step > 0; step /= 2){
+        if(x >> step){
+            x >>= step;
+            res += step;
+        }
+    }
+    return res;
+}
 
-static char* bitmaps_ptr(slab_alloc_t* slab, slab_page_t* page){
-    return (char*)page + sizeof(slab_page_t) + slab->cells * slab->ssize;
+// В каком списке должна лежать страница?
+static slab_list_t* page_list(slab_alloc_t* slab, slab_page_t* page){
+    if(page->used_cells == 0)
+        return &slab->empty;
+    if(page->used_cells == slab->cells)
+        return &slab->full;
+    return &slab->buckets[(uint64)page->used_cells * SLAB_BUCKETS / slab->cells];
 }
 
+// Перекладывает страницу в список, соответствующий её заполненности
+static void page_relink(slab_alloc_t* slab, slab_page_t* page){
+    slab_list_t* target = page_list(slab, page);
+    slab_list_t* list = page->list;
+    if(list == target)
+        return;
+    if(list){
+        list_remove(page);
+        if(list->len == 0)
+            slab->mask &= ~list->bit;
+    }
+    list_add(target, page);
+    slab->mask |= target->bit;
+}
+
+
+///////////////////////////////////////////////////////////
+///   Получение по странице ячеек выделяемых структур   ///
+///////////////////////////////////////////////////////////
+
 static void* cells_ptr(slab_alloc_t* slab, slab_page_t* page){
-    return (char*)page + sizeof(slab_page_t);
+    return (char*)page + page->offset;
+}
+
+static void* cell_ptr(slab_alloc_t* slab, slab_page_t* page, uint i){
+    return (char*)cells_ptr(slab, page) + i * slab->ssize;
 }
 
 ////////////////////////////////////
@@ -117,43 +156,100 @@ static void* cells_ptr(slab_alloc_t* slab, slab_page_t* page){
 ////////////////////////////////////
 
 
-static uint64 serv_pages(uint64 pgsize, uint64 n){
-    uint64 res = 1;
-    while(1){
-        if(res * pgsize >= n)
-            return res;
-        res *= 2;
+static void init_lists(slab_alloc_t* slab){
+    for(int i = 0; i < SLAB_BUCKETS; i++){
+        list_init(&slab->buckets[i], 1u << i);
     }
+    list_init(&slab->full, 0);
+    list_init(&slab->empty, 0);
+    slab->mask = 0;
 }
 
-static void init_lists(slab_alloc_t* slab){
-    uint64 lists_size = sizeof(slab_list_t) * slab->cells;
-    uint64 serv = serv_pages(slab->pgsize, lists_size);
-    slab->lists = slab->buddy_alloc(serv); 
-    ASSERT(slab->lists != 0);
-    for(int i = 0; i < slab->cells; i++){
-        list_init(&slab->lists[i], i);
+static uint64 roundup(uint64 x, uint64 align){
+    return (x + align - 1) / align * align;
+}
+
+// Сколько байт slab'а порядка order пропадает впустую
+static uint64 order_waste(uint64 pgsize, uint64 offset, uint ssize, uint order){
+    uint64 size = pgsize << order;
+    if(size < offset + ssize)
+        return size;
+    uint64 cells = (size - offset) / ssize;
+    return size - cells * ssize;
+}
+
+static uint choose_order(uint64 pgsize, uint64 offset, uint ssize){
+    uint best = SLAB_MAX_ORDER;
+    for(uint order = 0; order <= SLAB_MAX_ORDER; order++){
+        uint64 size = pgsize << order;
+        uint64 waste = order_waste(pgsize, offset, ssize, order);
+        if(waste * SLAB_WASTE_DIV <= size)
+            return order;
+        // waste / size < best_waste / best_size
+        if(waste * (pgsize << best) < order_waste(pgsize, offset, ssize, best) * size)
+            best = order;
     }
+    return best;
+}
+
+static uint color_step(slab_alloc_t* slab){
+    return slab->align > SLAB_CACHE_LINE ? slab->align : SLAB_CACHE_LINE;
 }
 
 void lib_slab_init(
     slab_alloc_t* slab,
     uint pgsize,
     uint ssize,
+    uint align,
     void* (*buddy_alloc)(uint64),
     void (*buddy_free)(void*),
-    void* (*pgbegin)(void*)
+    void* (*pgbegin)(void*),
+    void (*ctor)(void*),
+    void (*dtor)(void*)
 ){
+    // В свободной ячейке хранится номер следующей свободной
+    if(align < sizeof(uint))
+        align = sizeof(uint);
+    ASSERT((align & (align - 1)) == 0);
+    uint link = 0;
+    if(ctor){
+        link = roundup(ssize, sizeof(uint));
+        ssize = link + sizeof(uint);
+    }
+    ssize = roundup(ssize, align);
+
     slab->pgsize = pgsize;
     slab->ssize = ssize;
+    slab->align = align;
+    slab->link = link;
+    slab->ctor = ctor;
+    slab->dtor = dtor;
+    slab->offset = roundup(sizeof(slab_page_t), align);
+    slab->order = choose_order(pgsize, slab->offset, ssize);
     slab->buddy_alloc = buddy_alloc;
     slab->buddy_free = buddy_free;
     slab->pgbegin = pgbegin;
-    slab->cells = (pgsize - sizeof(slab_page_t)) / (1 + ssize);
+
+    uint64 size = (uint64)pgsize << slab->order;
+    slab->cells = (size - slab->offset) / ssize;
+    ASSERT(slab->cells > 0);
+    slab->colors = (size - slab->offset - slab->cells * ssize) / color_step(slab) + 1;
+    slab->color = 0;
+
+    slab->empty_low = SLAB_EMPTY_LOW;
+    slab->empty_high = SLAB_EMPTY_HIGH;
 
     init_lists(slab);
 }
 
+void lib_slab_set_reserve(slab_alloc_t* slab, uint low, uint high){
+    ASSERT(low <= high);
+    slab->empty_low = low;
+    slab->empty_high = high;
+    if(slab->empty.len > high)
+        lib_slab_shrink(slab, low);
+}
+
 
 ////////////////////////////
 ///   Выделение памяти   ///
@@ -163,55 +259,73 @@ void lib_slab_init(
 
 
 static slab_page_t* new_page(slab_alloc_t* slab){
-    slab_page_t* page = slab->buddy_alloc(1);
-    ASSERT(page != 0);
-    char* bitmaps = bitmaps_ptr(slab, page);
-    for(int i = 0; i < slab->cells; i++){
-        bitmaps[i] = 0;
-    }
-    ASSERT(bitmaps[0] == 0);
-    list_add(&slab->lists[0], page);
-    ASSERT(bitmaps_ptr(slab, page) == bitmaps);
-    ASSERT(bitmaps[0] == 0);
-    ASSERT(page->used_cells == 0);
-    ASSERT(page->list == &slab->lists[0]);
+    slab_page_t* page = slab->buddy_alloc(1 << slab->order);
+    if(page == 0)
+        return 0;
+    page->list = 0;
+    page->used_cells = 0;
+    page->free = SLAB_NONE;
+    page->fresh = 0;
+    page->owner = slab;
+    page->offset = slab->offset + slab->color * color_step(slab);
+    slab->color = (slab->color + 1) % slab->colors;
     return page;
 }
 
-static void* page_alloc_cell(slab_alloc_t* slab, slab_page_t* page){
+// Берёт ячейку из страницы, не перемещая страницу между списками
+static void* page_take_cell(slab_alloc_t* slab, slab_page_t* page){
     ASSERT(page->used_cells < slab->cells);
 
-    char* bitmaps = bitmaps_ptr(slab, page);
-    uint i = 0;
-    while(bitmaps[i] == 1){
-        ASSERT(i < page->used_cells);
-        i++;     
+    uint i;
+    if(page->free != SLAB_NONE){
+        i = page->free;
+        page->free = *(uint*)((char*)cell_ptr(slab, page, i) + slab->link);
+    } else {
+        ASSERT(page->fresh < slab->cells);
+        i = page->fresh++;
+        if(slab->ctor)
+            slab->ctor(cell_ptr(slab, page, i));
     }
 
-    ASSERT(bitmaps[i] == 0);
-    bitmaps[i] = 1;
-
-    list_remove(page);
-    list_add(&slab->lists[page->used_cells + 1], page);
+    page->used_cells += 1;
+    return cell_ptr(slab, page, i);
+}
 
-    return (char*)cells_ptr(slab, page) + i * slab->ssize;
+// Страница, из которой выделять: самая заполненная из частично занятых,
+// иначе пустая из резерва, иначе новая. 0, если не хватило памяти
+static slab_page_t* alloc_page(slab_alloc_t* slab){
+    if(slab->mask != 0)
+        return slab->buckets[highest_bit(slab->mask)].head.next;
+    if(slab->empty.len > 0)
+        return slab->empty.head.next;
+    return new_page(slab);
 }
 
 
 void* lib_slab_alloc(slab_alloc_t* slab){
-    int cells = slab->cells - 2;
-    while(cells >= 0){
-        slab_list_t* list = &slab->lists[cells];
-        if(list->len > 0){
-            slab_page_t* page = list->head.next;
-            return page_alloc_cell(slab, page);
-        }
-        cells -= 1;
-    }
+    slab_page_t* page = alloc_page(slab);
+    if(page == 0)
+        return 0;
+    void* res = page_take_cell(slab, page);
+    page_relink(slab, page);
+    return res;
+}
 
-    ASSERT(cells == -1);
-    slab_page_t* page = new_page(slab);
-    return page_alloc_cell(slab, page);
+/*
+Страница перемещается между списками один раз, после того как из неё
+взято сколько нужно (или всё, что было), а не после каждой ячейки.
+*/
+uint lib_slab_alloc_bulk(slab_alloc_t* slab, uint n, void** out){
+    uint res = 0;
+    while(res < n){
+        slab_page_t* page = alloc_page(slab);
+        if(page == 0)
+            break;
+        while(res < n && page->used_cells < slab->cells)
+            out[res++] = page_take_cell(slab, page);
+        page_relink(slab, page);
+    }
+    return res;
 }
 
 
@@ -221,11 +335,11 @@ void* lib_slab_alloc(slab_alloc_t* slab){
 
 
 static void page_clean_cell(slab_alloc_t* slab, slab_page_t* page, void* ptr){
-    char* bitmaps = bitmaps_ptr(slab, page);
     void* cells = cells_ptr(slab, page);
-    int i = ((char*)ptr - (char*)cells) / slab->ssize;
-    ASSERT(bitmaps[i] == 1);
-    bitmaps[i] = 0;
+    uint i = ((char*)ptr - (char*)cells) / slab->ssize;
+    ASSERT(i < page->fresh);
+    *(uint*)((char*)ptr + slab->link) = page->free;
+    page->free = i;
 }
 
 /*
@@ -234,10 +348,71 @@ NB!   Корректность адреса не проверяется.
 */
 void lib_slab_free(slab_alloc_t* slab, void* ptr){
     slab_page_t* page = slab->pgbegin(ptr);
-    list_remove(page);
-    if(page->used_cells == 1)
-        slab->buddy_free(page);
-    else 
-        list_add(&slab->lists[page->used_cells - 1], page);
+    ASSERT(page->owner == slab);
+    lib_slab_free_any(page, ptr);
+}
+
+/*
+Подряд идущие объекты одного slab'а освобождаются без вызова pgbegin
+и с одним перемещением страницы между списками.
+*/
+void lib_slab_free_bulk(slab_alloc_t* slab, uint n, void** ptrs){
+    uint64 size = (uint64)slab->pgsize << slab->order;
+    slab_page_t* page = 0;
+    for(uint i = 0; i < n; i++){
+        char* ptr = ptrs[i];
+        if(page == 0 || ptr < (char*)page || ptr >= (char*)page + size){
+            if(page)
+                page_relink(slab, page);
+            page = slab->pgbegin(ptr);
+            ASSERT(page->owner == slab);
+        }
+        page_clean_cell(slab, page, ptr);
+        page->used_cells -= 1;
+    }
+    if(page)
+        page_relink(slab, page);
+    if(slab->empty.len > slab->empty_high)
+        lib_slab_shrink(slab, slab->empty_low);
+}
+
+void lib_slab_free_any(void* pg, void* ptr){
+    slab_page_t* page = pg;
+    slab_alloc_t* slab = page->owner;
     page_clean_cell(slab, page, ptr);
+    page->used_cells -= 1;
+    page_relink(slab, page);
+    if(slab->empty.len > slab->empty_high)
+        lib_slab_shrink(slab, slab->empty_low);
+}
+
+void lib_slab_stat(slab_alloc_t* slab, uint64* used, uint64* slabs, uint64* partial, uint64* empty){
+    *used = (uint64)slab->full.len * slab->cells;
+    *partial = 0;
+    for(int b = 0; b < SLAB_BUCKETS; b++){
+        for(slab_page_t* page = slab->buckets[b].head.next; page; page = page->next)
+            *used += page->used_cells;
+        *partial += slab->buckets[b].len;
+    }
+    *empty = slab->empty.len;
+    *slabs = slab->full.len + *partial + *empty;
+}
+
+void* lib_slab_owner(void* page){
+    return ((slab_page_t*)page)->owner;
+}
+
+uint lib_slab_shrink(slab_alloc_t* slab, uint keep){
+    uint res = 0;
+    while(slab->empty.len > keep){
+        slab_page_t* page = slab->empty.head.next;
+        list_remove(page);
+        if(slab->dtor){
+            for(uint i = 0; i < page->fresh; i++)
+                slab->dtor(cell_ptr(slab, page, i));
+        }
+        slab->buddy_free(page);
+        res += 1;
+    }
+    return res;
 }
\ No newline at end of file
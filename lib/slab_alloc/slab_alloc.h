@@ -8,18 +8,99 @@
 #endif
 
 
+/*
+Каждая страница slab-аллокатора начинается с заголовка slab_page_t, за ним идут ячейки.
+Страницы, в которых есть и занятые, и свободные ячейки (частично занятые), разложены 
+по SLAB_BUCKETS корзинам по степени заполненности: в корзине b лежат страницы, у которых
+занято от b/SLAB_BUCKETS до (b+1)/SLAB_BUCKETS всех ячеек. Полностью занятые страницы 
+лежат в отдельном списке full. Битовая маска mask показывает, какие корзины непусты.
+Выделение берёт страницу из самой заполненной непустой корзины - так объекты плотнее
+упаковываются, а почти пустые страницы успевают освободиться. Поиск корзины - за константу.
+
+Пустые страницы не сразу возвращаются buddy-аллокатору, а копятся в списке empty, чтобы
+цикл "выделить объект - освободить объект" не выделял и не освобождал страницу каждый раз.
+Когда пустых страниц становится больше empty_high, лишние освобождаются, пока их не 
+останется empty_low (гистерезис). lib_slab_shrink освобождает пустые страницы по запросу.
+*/
+
+#define SLAB_BUCKETS 32
+
+/*
+Страница slab-аллокатора (slab) может состоять из нескольких страниц buddy-аллокатора:
+из 2^order штук. Порядок выбирается при инициализации - наименьший, при котором
+потери на хвост и заголовок не больше 1/SLAB_WASTE_DIV размера slab'а. Если такого нет
+до SLAB_MAX_ORDER включительно, берётся порядок с наименьшей долей потерь.
+Функция pgbegin должна по указателю внутри slab'а возвращать его начало.
+*/
+#define SLAB_MAX_ORDER 4
+#define SLAB_WASTE_DIV 16
+
+/*
+Ячейки выровнены по align (степень двойки) относительно начала slab'а: размер ячейки
+округляется вверх до кратного align, первая ячейка начинается с кратного align смещения.
+В ядре slab'ы начинаются на границе страницы, так что выравнивание получается абсолютным.
+Остаток slab'а после последней ячейки используется для раскраски (cache coloring):
+у очередных slab'ов первая ячейка сдвигается на 0, 1, 2, ... шага раскраски
+(max(align, SLAB_CACHE_LINE) байт), чтобы одинаковые поля объектов разных slab'ов
+не попадали в одни и те же наборы кэша.
+*/
+#define SLAB_CACHE_LINE 64
+
+/*
+Конструктор ctor вызывается для ячейки один раз - когда она впервые выделяется из
+нового slab'а; деструктор dtor - для всех когда-либо выделенных ячеек slab'а перед 
+возвращением slab'а buddy-аллокатору. Освобождаемый объект должен быть в том же 
+состоянии, в каком его оставил конструктор: следующий lib_slab_alloc вернёт его как есть.
+Чтобы номер следующей свободной ячейки не портил сконструированный объект, при 
+наличии конструктора он хранится не в начале ячейки, а после объекта.
+*/
+
+// Размер резерва пустых страниц по умолчанию
+#define SLAB_EMPTY_LOW  1
+#define SLAB_EMPTY_HIGH 4
 
 struct slab_list;
 
+// Лежит в начале каждой страницы
+typedef struct slab_page{
+    struct slab_page* next;
+    struct slab_page* prev;
+    struct slab_list* list;     // список, в котором лежит страница, или 0
+    uint used_cells;
+    uint free;      // номер первой свободной ячейки или SLAB_NONE
+    uint fresh;     // количество ячеек, которые хоть раз выделялись
+    uint offset;    // смещение первой ячейки от начала slab'а
+    void* owner;    // аллокатор (slab_alloc_t*), которому принадлежит slab
+} slab_page_t;
+
+typedef struct slab_list{
+    slab_page_t head;
+    uint len;
+    uint bit;       // бит этого списка в slab_alloc_t.mask (0 для списков full и empty)
+} slab_list_t;
+
 
 typedef struct{
-    struct slab_list* lists;
+    slab_list_t buckets[SLAB_BUCKETS];  // частично занятые страницы
+    slab_list_t full;                   // полностью занятые страницы
+    slab_list_t empty;                  // резерв пустых страниц
+    uint mask;                          // i-й бит установлен <=> buckets[i] непуст
+    uint empty_low;
+    uint empty_high;
     uint pgsize;
-    uint ssize;     // struct size
-    uint cells;     // cells in page
+    uint order;     // в slab'е 2^order страниц
+    uint ssize;     // размер ячейки: размер структуры, округлённый до align
+    uint align;
+    uint link;      // смещение номера следующей свободной ячейки внутри свободной ячейки
+    uint cells;     // cells in slab
+    uint offset;    // смещение первой ячейки без раскраски
+    uint colors;    // количество различных сдвигов
+    uint color;     // сдвиг (в шагах раскраски) для следующего нового slab'а
     void* (*buddy_alloc)(uint64);
     void (*buddy_free)(void*);
     void* (*pgbegin)(void*); 
+    void (*ctor)(void*);
+    void (*dtor)(void*);
 } slab_alloc_t;
 
 
@@ -27,11 +108,36 @@ void lib_slab_init(
     slab_alloc_t* slab,
     uint pgsize,
     uint ssize,
+    uint align,     // выравнивание объектов, степень двойки; 0 - по умолчанию
     void* (*buddy_alloc)(uint64),
     void (*buddy_free)(void*),
-    void* (*pgbegin)(void*)
+    void* (*pgbegin)(void*),
+    void (*ctor)(void*),    // конструктор объекта или 0
+    void (*dtor)(void*)     // деструктор объекта или 0
 );
 
 
+// Возвращает 0, если для новой страницы не хватило памяти
 void* lib_slab_alloc(slab_alloc_t* slab);
-void lib_slab_free(slab_alloc_t* slab, void* ptr);
\ No newline at end of file
+void lib_slab_free(slab_alloc_t* slab, void* ptr);
+
+// Выделяет до n объектов в out. Возвращает, сколько выделено: меньше n, если не хватило памяти
+uint lib_slab_alloc_bulk(slab_alloc_t* slab, uint n, void** out);
+// Освобождает n объектов из ptrs; быстрее всего, если объекты одного slab'а идут подряд
+void lib_slab_free_bulk(slab_alloc_t* slab, uint n, void** ptrs);
+
+// Освобождает объект ptr из slab'а, начинающегося в page. Аллокатор берётся из заголовка
+// slab'а, а pgbegin не вызывается: вызывающий уже знает начало slab'а
+void lib_slab_free_any(void* page, void* ptr);
+
+// По началу slab'а (результату pgbegin) возвращает аллокатор, которому он принадлежит
+void* lib_slab_owner(void* page);
+
+// Число выделенных объектов и slab'ов: всего, частично занятых и пустых
+void lib_slab_stat(slab_alloc_t* slab, uint64* used, uint64* slabs, uint64* partial, uint64* empty);
+
+// Задаёт границы резерва пустых страниц; low <= high
+void lib_slab_set_reserve(slab_alloc_t* slab, uint low, uint high);
+
+// Возвращает buddy-аллокатору пустые страницы, пока их не останется keep. Возвращает число освобождённых страниц
+uint lib_slab_shrink(slab_alloc_t* slab, uint keep);
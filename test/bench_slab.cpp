@@ -0,0 +1,156 @@
+// Замеры скорости slab-аллокатора на объектах разного размера.
+// Собирается вместе с тестами, запускать: ./bench_slab
+
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <random>
+
+extern "C"{
+    #include "buddy_alloc.h"
+    #include "slab_alloc.h"
+}
+
+
+buddy_allocator_t mem;
+long buddy_calls;
+
+void* buddy_alloc(uint64 pages){
+    buddy_calls++;
+    return lib_buddy_alloc(&mem, pages);
+}
+
+void buddy_free(void* ptr){
+    buddy_calls++;
+    lib_buddy_free(&mem, ptr);
+}
+
+void* pgbegin(void* ptr){
+    return lib_buddy_block_start(&mem, ptr);
+}
+
+
+const uint64 pgsize = 4096;
+const uint64 pages = 4096;
+const int rounds = 20;
+
+double now_ns(){
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Выделяет n объектов, затем освобождает их в том же порядке
+double bench_fill_drain(slab_alloc_t* slab, int n){
+    std::vector<void*> v(n);
+    double start = now_ns();
+    for(int r = 0; r < rounds; r++){
+        for(int i = 0; i < n; i++)
+            v[i] = lib_slab_alloc(slab);
+        for(int i = 0; i < n; i++)
+            lib_slab_free(slab, v[i]);
+    }
+    return (now_ns() - start) / (2.0 * rounds * n);
+}
+
+// Держит n живых объектов, освобождает случайный и сразу выделяет новый
+double bench_churn(slab_alloc_t* slab, int n){
+    std::vector<void*> v(n);
+    std::mt19937 gen(239);
+    for(int i = 0; i < n; i++)
+        v[i] = lib_slab_alloc(slab);
+    int ops = rounds * n;
+    double start = now_ns();
+    for(int k = 0; k < ops; k++){
+        int i = gen() % n;
+        lib_slab_free(slab, v[i]);
+        v[i] = lib_slab_alloc(slab);
+    }
+    double res = (now_ns() - start) / (2.0 * ops);
+    for(int i = 0; i < n; i++)
+        lib_slab_free(slab, v[i]);
+    return res;
+}
+
+// Как создание и закрытие одного pipe: единственный объект выделяется и сразу освобождается
+double bench_pipe_cycle(slab_alloc_t* slab, int n){
+    double start = now_ns();
+    for(int i = 0; i < n; i++){
+        void* p = lib_slab_alloc(slab);
+        lib_slab_free(slab, p);
+    }
+    return (now_ns() - start) / n;
+}
+
+// Выделяет и освобождает пачки по batch объектов: по одному или через *_bulk
+double bench_batch(slab_alloc_t* slab, int batch, bool bulk, int n){
+    std::vector<void*> v(batch);
+    double start = now_ns();
+    for(int k = 0; k < n; k++){
+        if(bulk){
+            uint got = lib_slab_alloc_bulk(slab, batch, &v[0]);
+            assert(got == (uint)batch);
+            lib_slab_free_bulk(slab, batch, &v[0]);
+        } else {
+            for(int i = 0; i < batch; i++)
+                v[i] = lib_slab_alloc(slab);
+            for(int i = 0; i < batch; i++)
+                lib_slab_free(slab, v[i]);
+        }
+    }
+    return (now_ns() - start) / (2.0 * n * batch);
+}
+
+int main(){
+    std::vector<char> data(pgsize * pages);
+    lib_buddy_init(&mem, 10, pgsize, pages, &data[0]);
+
+    printf("%8s %8s %16s %16s\n", "size", "objects", "fill/drain ns", "churn ns");
+    for(uint ssize: {8, 64, 512}){
+        slab_alloc_t slab;
+        lib_slab_init(&slab, pgsize, ssize, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+        int n = (pages / 2) * pgsize / (ssize + 8) / 2;
+        double fd = bench_fill_drain(&slab, n);
+        double ch = bench_churn(&slab, n);
+        printf("%8u %8d %16.1f %16.1f\n", ssize, n, fd, ch);
+    }
+
+    // Потери на хвост и заголовок для размеров структур ядра: в slab'е из одной
+    // страницы и в slab'е выбранного порядка
+    printf("\n%8s %16s %8s %16s\n", "size", "waste 1 page", "order", "waste chosen");
+    for(uint ssize: {16, 288, 552, 1000, 2100, 5000}){
+        slab_alloc_t slab;
+        lib_slab_init(&slab, pgsize, ssize, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+        uint64 one = pgsize < slab.offset + slab.ssize ? pgsize :
+            pgsize - (pgsize - slab.offset) / slab.ssize * slab.ssize;
+        uint64 size = pgsize << slab.order;
+        uint64 chosen = size - slab.cells * ssize;
+        printf("%8u %15.1f%% %8u %15.1f%%\n", ssize, 100.0 * one / pgsize, slab.order, 100.0 * chosen / size);
+    }
+
+    // 552 - примерно sizeof(struct pipe) в ядре
+    printf("\n%8s %16s %16s\n", "reserve", "pipe cycle ns", "buddy calls");
+    for(uint reserve: {0, SLAB_EMPTY_HIGH}){
+        slab_alloc_t slab;
+        lib_slab_init(&slab, pgsize, 552, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+        lib_slab_set_reserve(&slab, reserve == 0 ? 0 : SLAB_EMPTY_LOW, reserve);
+        int n = 1000000;
+        buddy_calls = 0;
+        double t = bench_pipe_cycle(&slab, n);
+        printf("%8u %16.1f %16ld\n", reserve, t, buddy_calls);
+        lib_slab_shrink(&slab, 0);
+    }
+
+    printf("\n%8s %8s %16s %16s\n", "size", "batch", "one by one ns", "bulk ns");
+    for(uint ssize: {64, 512}){
+        for(int batch: {3, 16, 64}){
+            slab_alloc_t slab;
+            lib_slab_init(&slab, pgsize, ssize, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+            int n = 2000000 / batch;
+            double one = bench_batch(&slab, batch, false, n);
+            double bulk = bench_batch(&slab, batch, true, n);
+            printf("%8u %8d %16.1f %16.1f\n", ssize, batch, one, bulk);
+            lib_slab_shrink(&slab, 0);
+        }
+    }
+}
@@ -143,9 +143,10 @@ TEST_CASE("init_"){
         free(ptr); \
     }while(0)
 
-    TEST_INIT(1, 100, 1000, 11, {1000 - 11});
-    TEST_INIT(2, 100, 1000, 11, {1, 494});          // 494 = (1000-11)/2
-    TEST_INIT(3, 100, 1001, 12, {1, 0, 494 / 2});
+    // Служебные страницы: списки, по 16 байт описателя и байту состояния на страницу
+    TEST_INIT(1, 100, 1000, 171, {1000 - 171});
+    TEST_INIT(2, 100, 1000, 171, {1, 414});         // 414 = (1000-171)/2
+    TEST_INIT(3, 100, 1001, 172, {1, 0, 414 / 2});
 
     #undef TEST_INIT
 }
@@ -210,16 +211,16 @@ TEST_CASE("good alloc"){
     }
 
     // Тесты на выделение всех доступных страниц
-    TEST_GOOD_ALLOC(10, 10000, (1 + 1024 - 1), {512, 256, 128, 64, 32, 16, 8, 4, 2, 1});
-    TEST_GOOD_ALLOC(10, 10000, (1 + 1024 - 1), {1, 2, 4, 8, 16, 32, 64, 128, 256, 512});
-    TEST_GOOD_ALLOC(11, 10000, (1 + 1024), {1024});
+    TEST_GOOD_ALLOC(10, 10000, (2 + 1024 - 1), {512, 256, 128, 64, 32, 16, 8, 4, 2, 1});
+    TEST_GOOD_ALLOC(10, 10000, (2 + 1024 - 1), {1, 2, 4, 8, 16, 32, 64, 128, 256, 512});
+    TEST_GOOD_ALLOC(11, 10000, (2 + 1024), {1024});
 
     #undef TEST_GOOD_ALLOC
 }
 
 
 TEST_CASE(""){
-    BuddyAllocator mem(10, 4096, 1001);
+    BuddyAllocator mem(10, 4096, 1005);
     
     REQUIRE_EQ(mem.mem.pages, 1000);
     for(int i = 0; i < 1000; i++){
@@ -231,4 +232,90 @@ TEST_CASE(""){
         mem.free(mem.alloc_blocks.begin()->ptr);
     }
 
-}
\ No newline at end of file
+}
+
+TEST_CASE("split and merge counters"){
+    BuddyAllocator mem(4, 1000, 1 + 8);
+    REQUIRE_EQ(mem.mem.lists[3].len, 1);
+
+    void* a = mem.alloc(1);     // 8 -> 4 + 2 + 1 + 1
+    CHECK_EQ(mem.mem.splits, 3);
+    void* b = mem.alloc(1);     // свободный блок уровня 0 уже есть
+    CHECK_EQ(mem.mem.splits, 3);
+
+    mem.free(b);
+    CHECK_EQ(mem.mem.merges, 0);    // сосед b - это занятый a
+    CHECK_EQ(lib_buddy_free(&mem.mem, a), 0);
+    CHECK_EQ(mem.mem.merges, 3);
+    CHECK_EQ(mem.mem.lists[3].len, 1);
+}
+
+
+TEST_CASE("free lists after frees in arbitrary order"){
+    BuddyAllocator mem(2, 1000, 1 + 8);
+    void* a = mem.alloc(1);
+    void* b = mem.alloc(1);
+    void* c = mem.alloc(2);
+    void* d = mem.alloc(2);
+    mem.free(c);
+    mem.free(a);
+    mem.free(d);
+    mem.free(b);
+    CHECK_EQ(mem.mem.lists[0].len, 0);
+    CHECK_EQ(mem.mem.lists[1].len, 4);  // верхний уровень, дальше не склеиваются
+
+    std::vector<void*> blocks;
+    for(int i = 0; i < 4; i++){
+        blocks.push_back(mem.alloc(2));
+        CHECK_NE(blocks.back(), nullptr);
+    }
+    CHECK_EQ(mem.alloc(1), nullptr);
+}
+
+
+TEST_CASE("block start"){
+    BuddyAllocator mem(4, 1000, 1 + 8);
+    char* a = (char*)mem.alloc(1);
+    char* b = (char*)mem.alloc(4);
+    CHECK_EQ(lib_buddy_block_start(&mem.mem, a), a);
+    CHECK_EQ(lib_buddy_block_start(&mem.mem, a + 999), a);
+    CHECK_EQ(lib_buddy_block_start(&mem.mem, b + 1), b);
+    CHECK_EQ(lib_buddy_block_start(&mem.mem, b + 3 * 1000 + 5), b);
+    mem.free(b);
+    CHECK_EQ(lib_buddy_block_start(&mem.mem, b + 3 * 1000 + 5), nullptr);
+    CHECK_EQ(lib_buddy_block_start(&mem.mem, a - 1), nullptr);
+}
+
+
+TEST_CASE("frame refcounts"){
+    BuddyAllocator mem(4, 1000, 1 + 8);
+    char* a = (char*)mem.alloc(2);
+    buddy_frame_t* f = lib_buddy_frame(&mem.mem, a);
+    REQUIRE_NE(f, nullptr);
+    CHECK_EQ(f->refs, 1);
+    CHECK_EQ(lib_buddy_frame(&mem.mem, a + 1000 + 5), f + 1);
+    CHECK_EQ(lib_buddy_frame(&mem.mem, a - 1), nullptr);
+
+    f->flags = 3;
+    f->rmap = 42;
+    lib_buddy_get(&mem.mem, a);
+    lib_buddy_get(&mem.mem, a);
+    CHECK_EQ(f->refs, 3);
+    CHECK_EQ(lib_buddy_put(&mem.mem, a), BUDDY_NOTHING);
+    CHECK_EQ(lib_buddy_put(&mem.mem, a), BUDDY_NOTHING);
+    CHECK_EQ(lib_buddy_block_start(&mem.mem, a), a);   // блок всё ещё выделен
+    check(&mem.mem);
+
+    CHECK_EQ(lib_buddy_put(&mem.mem, a), 1);
+    CHECK_EQ(lib_buddy_block_start(&mem.mem, a), nullptr);
+    CHECK_EQ(f->refs, 0);
+    CHECK_EQ(f->flags, 0);
+    CHECK_EQ(f->rmap, 0);
+    CHECK_EQ(mem.mem.lists[3].len, 1);
+    check(&mem.mem);
+
+    // Новое выделение той же памяти начинает с чистого описателя
+    char* b = (char*)lib_buddy_alloc(&mem.mem, 8);
+    CHECK_EQ(lib_buddy_frame(&mem.mem, b)->refs, 1);
+    CHECK_EQ(lib_buddy_free(&mem.mem, b), 3);
+}
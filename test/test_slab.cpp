@@ -3,6 +3,7 @@
 // #include "doctest.h"
 #include <vector>
 #include <cassert>
+#include <cstring>
 
 extern "C"{
     #include "buddy_alloc.h"
@@ -21,8 +22,7 @@ void buddy_free(void* ptr){
 }
 
 void* pgbegin(void* ptr){
-    uint d = (char*)ptr - (char*)mem.data;
-    return (char*)ptr - d % mem.pgsize;
+    return lib_buddy_block_start(&mem, ptr);
 }
 
 
@@ -60,6 +60,207 @@ void checkmem(){
     }
 }
 
+// Новые объекты должны выделяться из самой заполненной страницы
+void test_prefer_fuller(){
+    slab_alloc_t slab;
+    lib_slab_init(&slab, mem.pgsize, 100, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+    uint cells = slab.cells;
+
+    std::vector<void*> v(3 * cells);
+    for(uint i = 0; i < 3 * cells; i++)
+        v[i] = lib_slab_alloc(&slab);
+    // на первой странице остаётся одна занятая ячейка, на второй - почти все, третья полна
+    for(uint i = 1; i < cells; i++)
+        lib_slab_free(&slab, v[i]);
+    lib_slab_free(&slab, v[cells]);
+    lib_slab_free(&slab, v[cells + 1]);
+
+    void* p = lib_slab_alloc(&slab);
+    assert(pgbegin(p) == pgbegin(v[cells]));
+    void* q = lib_slab_alloc(&slab);
+    assert(pgbegin(q) == pgbegin(v[cells]));
+    void* r = lib_slab_alloc(&slab);
+    assert(pgbegin(r) == pgbegin(v[0]));
+
+    for(void* x: {p, q, r, v[0]})
+        lib_slab_free(&slab, x);
+    for(uint i = cells + 2; i < 3 * cells; i++)
+        lib_slab_free(&slab, v[i]);
+    assert(slab.mask == 0 && slab.full.len == 0);
+    assert(slab.empty.len <= SLAB_EMPTY_HIGH);
+    lib_slab_shrink(&slab, 0);
+    assert(slab.empty.len == 0);
+}
+
+// Пустые страницы копятся до empty_high, затем освобождаются до empty_low
+void test_empty_reserve(){
+    slab_alloc_t slab;
+    lib_slab_init(&slab, mem.pgsize, 1000, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+    lib_slab_set_reserve(&slab, 1, 3);
+    uint64 free_before;
+    lib_buddy_stat(&mem, 0, &free_before, 0);
+
+    std::vector<void*> v;
+    for(uint i = 0; i < 4 * slab.cells; i++)
+        v.push_back(lib_slab_alloc(&slab));
+    for(uint i = 0; i < 3 * slab.cells; i++)
+        lib_slab_free(&slab, v[i]);
+    assert(slab.empty.len == 3);
+    for(uint i = 3 * slab.cells; i < 4 * slab.cells; i++)
+        lib_slab_free(&slab, v[i]);
+    assert(slab.empty.len == 1);
+
+    // страница из резерва используется повторно без обращения к buddy
+    uint64 free_mid;
+    lib_buddy_stat(&mem, 0, &free_mid, 0);
+    lib_slab_free(&slab, lib_slab_alloc(&slab));
+    uint64 free_after;
+    lib_buddy_stat(&mem, 0, &free_after, 0);
+    assert(free_after == free_mid);
+
+    assert(lib_slab_shrink(&slab, 0) == 1);
+    lib_buddy_stat(&mem, 0, &free_after, 0);
+    assert(free_after == free_before);
+}
+
+// Объекты больше страницы лежат в slab'ах из нескольких страниц
+void test_multipage(){
+    slab_alloc_t slab;
+    lib_slab_init(&slab, mem.pgsize, 5000, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+    assert(slab.order > 0);
+    assert(slab.cells > 1);
+
+    randmem_v.clear();
+    initrand(45);
+    std::vector<void*> v(2 * slab.cells);
+    for(auto& p: v){
+        p = lib_slab_alloc(&slab);
+        assert(p != 0);
+        randmem(p, 5000);
+    }
+    checkmem();
+    assert(pgbegin((char*)v[slab.cells - 1] + 4999) == pgbegin(v[0]));
+    assert(pgbegin(v[slab.cells]) != pgbegin(v[0]));
+    for(auto p: v)
+        lib_slab_free(&slab, p);
+    randmem_v.clear();
+    lib_slab_shrink(&slab, 0);
+}
+
+// Ячейки выровнены, а первые ячейки новых slab'ов сдвигаются по цветам
+void test_align_color(){
+    slab_alloc_t slab;
+    lib_slab_init(&slab, mem.pgsize, 100, 64, buddy_alloc, buddy_free, pgbegin, 0, 0);
+    assert(slab.ssize == 128);
+    assert(slab.colors > 1);
+
+    std::vector<void*> v(slab.colors * slab.cells);
+    for(auto& p: v){
+        p = lib_slab_alloc(&slab);
+        assert(((char*)p - (char*)pgbegin(p)) % 64 == 0);
+    }
+    for(uint i = 0; i < slab.colors; i++){
+        void* first = v[i * slab.cells];
+        uint64 offset = (char*)first - (char*)pgbegin(first);
+        assert(offset == slab.offset + i * SLAB_CACHE_LINE);
+    }
+    for(auto p: v)
+        lib_slab_free(&slab, p);
+    lib_slab_shrink(&slab, 0);
+}
+
+struct ctor_obj{
+    int state;
+    char data[50];
+};
+
+int constructed;
+
+void obj_ctor(void* ptr){
+    ((ctor_obj*)ptr)->state = 239;
+    constructed++;
+}
+
+void obj_dtor(void* ptr){
+    assert(((ctor_obj*)ptr)->state == 239);
+    constructed--;
+}
+
+// Объекты выдаются сконструированными, а свободная ячейка не портит их состояние
+void test_ctor_dtor(){
+    slab_alloc_t slab;
+    lib_slab_init(&slab, mem.pgsize, sizeof(ctor_obj), 0, buddy_alloc, buddy_free, pgbegin, obj_ctor, obj_dtor);
+
+    std::vector<void*> v(3 * slab.cells);
+    for(auto& p: v)
+        p = lib_slab_alloc(&slab);
+    assert(constructed == (int)v.size());
+    for(auto p: v)
+        lib_slab_free(&slab, p);
+    for(auto& p: v){
+        p = lib_slab_alloc(&slab);
+        assert(((ctor_obj*)p)->state == 239);
+    }
+    assert(constructed == (int)v.size());
+    for(auto p: v)
+        lib_slab_free(&slab, p);
+    lib_slab_shrink(&slab, 0);
+    assert(constructed == 0);
+}
+
+// Объекты двух аллокаторов освобождаются без указания аллокатора
+void test_free_any(){
+    slab_alloc_t a, b;
+    lib_slab_init(&a, mem.pgsize, 24, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+    lib_slab_init(&b, mem.pgsize, 200, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+
+    std::vector<void*> v;
+    for(int i = 0; i < 1000; i++)
+        v.push_back(lib_slab_alloc(i % 2 ? &a : &b));
+    for(int i = 0; i < 1000; i++){
+        void* page = pgbegin(v[i]);
+        assert(lib_slab_owner(page) == (i % 2 ? &a : &b));
+        lib_slab_free_any(page, v[i]);
+    }
+    assert(a.mask == 0 && a.full.len == 0);
+    assert(b.mask == 0 && b.full.len == 0);
+    lib_slab_shrink(&a, 0);
+    lib_slab_shrink(&b, 0);
+}
+
+void test_bulk(){
+    slab_alloc_t slab;
+    lib_slab_init(&slab, mem.pgsize, 100, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
+    uint n = slab.cells * 3 + 5;
+
+    std::vector<void*> v(n);
+    assert(lib_slab_alloc_bulk(&slab, n, &v[0]) == n);
+    // Объекты не пересекаются
+    for(uint i = 0; i < n; i++)
+        memset(v[i], i, 100);
+    for(uint i = 0; i < n; i++)
+        assert(((unsigned char*)v[i])[0] == (unsigned char)i && ((unsigned char*)v[i])[99] == (unsigned char)i);
+    assert(slab.full.len == 3 && slab.mask != 0);
+    uint64 used, slabs, partial, empty;
+    lib_slab_stat(&slab, &used, &slabs, &partial, &empty);
+    assert(used == n && slabs == 4 && partial == 1 && empty == 0);
+
+    // Освобождаем вперемешку с одиночными выделениями
+    void* p = lib_slab_alloc(&slab);
+    lib_slab_free_bulk(&slab, n / 2, &v[0]);
+    lib_slab_free(&slab, p);
+    lib_slab_free_bulk(&slab, n - n / 2, &v[n / 2]);
+    assert(slab.mask == 0 && slab.full.len == 0);
+
+    // Памяти не хватает: выделяется сколько получилось
+    std::vector<void*> w(mem.pgsize * mem.pages / 100 * 2);
+    uint got = lib_slab_alloc_bulk(&slab, w.size(), &w[0]);
+    assert(got > 0 && got < w.size());
+    assert(lib_slab_alloc(&slab) == 0);
+    lib_slab_free_bulk(&slab, got, &w[0]);
+    lib_slab_shrink(&slab, 0);
+}
+
 int main(){
     randseed = 0;
     int levels = 10;
@@ -70,7 +271,7 @@ int main(){
 
     slab_alloc_t slab;
     uint ssize = 10;
-    lib_slab_init(&slab, pgsize, ssize, buddy_alloc, buddy_free, pgbegin);
+    lib_slab_init(&slab, pgsize, ssize, 0, buddy_alloc, buddy_free, pgbegin, 0, 0);
 
     initrand(123);
 
@@ -83,5 +284,14 @@ int main(){
     for(int i = 0; i < 10000; i++){
         lib_slab_free(&slab, v[i]);
     }
+    lib_slab_shrink(&slab, 0);
+
+    test_prefer_fuller();
+    test_empty_reserve();
+    test_multipage();
+    test_align_color();
+    test_ctor_dtor();
+    test_free_any();
+    test_bulk();
 }
 
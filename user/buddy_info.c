@@ -1,21 +1,80 @@
-
 #include "kernel/types.h"
 #include "kernel/buddy_alloc.h"
 #include "user/user.h"
 
-int main(){
-    struct buddy_info info;
-    if(buddy_info(&info) != 0){
-        printf("buddy info: kernel error\n");
+static void print_info(struct buddy_info* info){
+    printf("buddy_info:\n  total=%d,\n  free=%d,\n  free_by_size={", info->total, info->free);
+    for(int i = 0; i < BUDDY_LEVELS; i++){
+        printf("%d", info->free_by_size[i]);
+        if(i != BUDDY_LEVELS - 1)
+            printf(",");
     }
+    printf("}\n");
+}
 
-    printf("buddy_info:\n  total=%d,\n  free=%d,\n  free_by_size={", info.total, info.free);
+static void print_by_order(char* name, uint64* now, uint64* prev){
+    printf("  %s={", name);
     for(int i = 0; i < BUDDY_LEVELS; i++){
-        printf("%d", info.free_by_size[i]);
+        printf("%l", now[i] - prev[i]);
         if(i != BUDDY_LEVELS - 1)
             printf(",");
     }
     printf("}\n");
+}
+
+// Печатает, сколько событий произошло между снимками prev и now
+static void print_rates(struct buddy_info* now, struct buddy_info* prev, int ticks){
+    printf("per %d ticks: free=%d\n", ticks, now->free);
+    print_by_order("allocs", now->allocs, prev->allocs);
+    print_by_order("frees", now->frees, prev->frees);
+    printf("  failures=%l, splits=%l, merges=%l, spins=%l, reclaimed=%l\n",
+        now->failures - prev->failures, now->splits - prev->splits,
+        now->merges - prev->merges, now->spins - prev->spins,
+        now->reclaimed - prev->reclaimed);
+    printf("  slab: allocs=%l, frees=%l, failures=%l, spins=%l\n",
+        now->slab_allocs - prev->slab_allocs, now->slab_frees - prev->slab_frees,
+        now->slab_failures - prev->slab_failures, now->slab_spins - prev->slab_spins);
+    printf("  pagetable: allocs=%l, cached=%l, refills=%l, time=%l\n",
+        now->pt_allocs - prev->pt_allocs, now->pt_cached - prev->pt_cached,
+        now->pt_refills - prev->pt_refills, now->pt_time - prev->pt_time);
+}
+
+/*
+buddy_info                      печатает состояние кучи
+buddy_info -i ticks [count]     каждые ticks тиков печатает частоты событий
+                                аллокаторов (count раз, по умолчанию бесконечно)
+*/
+int main(int argc, char* argv[]){
+    struct buddy_info info;
+    if(buddy_info(&info) != 0){
+        printf("buddy info: kernel error\n");
+        exit(1);
+    }
+
+    if(argc == 1){
+        print_info(&info);
+        exit(0);
+    }
+
+    if(argc > 4 || strcmp(argv[1], "-i") != 0 || argc < 3 || atoi(argv[2]) <= 0){
+        fprintf(2, "usage: buddy_info [-i ticks [count]]\n");
+        exit(1);
+    }
+    int ticks = atoi(argv[2]);
+    int count = argc == 4 ? atoi(argv[3]) : -1;
+
+    struct buddy_info prev;
+    while(count != 0){
+        prev = info;
+        sleep(ticks);
+        if(buddy_info(&info) != 0){
+            printf("buddy info: kernel error\n");
+            exit(1);
+        }
+        print_rates(&info, &prev, ticks);
+        if(count > 0)
+            count--;
+    }
 
     exit(0);
-}
\ No newline at end of file
+}
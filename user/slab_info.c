@@ -0,0 +1,75 @@
+#include "kernel/types.h"
+#include "kernel/buddy_alloc.h"
+#include "user/user.h"
+
+// Печатает число, дополняя его слева пробелами до width символов
+static void print_num(uint64 x, int width){
+    int len = 1;
+    for(uint64 y = x; y >= 10; y /= 10)
+        len++;
+    for(; len < width; len++)
+        printf(" ");
+    printf("%l", x);
+}
+
+static void print_name(char* name, int width){
+    printf("%s", name);
+    for(int len = strlen(name); len < width; len++)
+        printf(" ");
+}
+
+/*
+slab_info       печатает по строке на каждый slab-кэш ядра:
+    size        размер объекта
+    cell        размер ячейки с выравниванием
+    objs/slab   объектов в slab'е
+    pages       страниц в slab'е
+    active      выделенных объектов
+    cached      свободных объектов в магазинах
+    slabs       всего slab'ов, из них partial частично занятых и empty пустых
+    waste       байт slab'ов, не занятых выделенными объектами
+    allocs, frees   выделений и освобождений с загрузки
+*/
+int main(int argc, char* argv[]){
+    int n = slab_info(0, 0);
+    if(n < 0){
+        printf("slab info: kernel error\n");
+        exit(1);
+    }
+    struct slab_info* info = malloc(n * sizeof(struct slab_info));
+    if(info == 0){
+        printf("slab info: out of memory\n");
+        exit(1);
+    }
+    // Пока выделяли память, кэшей могло стать больше
+    int count = slab_info(info, n);
+    if(count < 0){
+        printf("slab info: kernel error\n");
+        exit(1);
+    }
+    if(count > n)
+        count = n;
+
+    print_name("name", SLAB_NAME);
+    printf("  size  cell objs/slab pages  active  cached slabs partial empty     waste    allocs     frees\n");
+    for(int i = 0; i < count; i++){
+        struct slab_info* s = &info[i];
+        print_name(s->name, SLAB_NAME);
+        print_num(s->size, 6);
+        print_num(s->cell, 6);
+        print_num(s->per_slab, 10);
+        print_num(s->slab_pages, 6);
+        print_num(s->active, 8);
+        print_num(s->cached, 8);
+        print_num(s->slabs, 6);
+        print_num(s->partial, 8);
+        print_num(s->empty, 6);
+        print_num(s->waste, 10);
+        print_num(s->allocs, 10);
+        print_num(s->frees, 10);
+        printf("\n");
+    }
+
+    free(info);
+    exit(0);
+}
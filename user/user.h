@@ -1,5 +1,6 @@
 struct stat;
 struct buddy_info;
+struct slab_info;
 
 // system calls
 int fork(void);
@@ -25,6 +26,7 @@ int sleep(int);
 int uptime(void);
 int dummy(void);
 int buddy_info(struct buddy_info*);
+int slab_info(struct slab_info*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
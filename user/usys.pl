@@ -37,4 +37,5 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("dummy");
-entry("buddy_info");
\ No newline at end of file
+entry("buddy_info");
+entry("slab_info");
\ No newline at end of file